@@ -78,15 +78,18 @@ private:
   Ptree* TranslateAlt(Environment* env,Ptree* keyword, Ptree* rest);
   Ptree* TranslatePriAlt(Environment* env,Ptree* keyword, Ptree* rest);
   Ptree* TranslateAfor(Environment* env,Ptree* keyword, Ptree* rest);
+  Ptree* TranslateAwhile(Environment* env,Ptree* keyword, Ptree* rest);
   Ptree* TranslateSpawn(Environment* env,Ptree* keyword, Ptree* rest);
 
   // Various helper functions.
   void makeThreadStruct(Environment *env,Ptree *type,Ptree *args,const ArgVect &av);
   void convertToThread(Ptree* &elist,Ptree* &thnames,Ptree *expr,VarWalker *vw,
-                       Environment *env,bool heapalloc);
-  Ptree *generateAltBlock(Environment *env,const PortList &pv,Ptree *defaultblock);
+                       Environment *env,bool heapalloc,Ptree *chunks = 0);
+  Ptree *generateAltBlock(Environment *env,const PortList &pv,Ptree *defaultblock,
+                          Ptree *cond = 0);
   Ptree *generateAltBody(Environment *env,Ptree *cur,Ptree *label,
-                         Ptree *handle,const PortList &pv,Ptree *defaultblock);
+                         Ptree *handle,Ptree *sindex,const PortList &pv,
+                         Ptree *defaultblock,Ptree *ws,bool persist);
   bool parseAforCondition(VarWalker *vs,Environment *env,Ptree *s1,Ptree *s3);
   bool parseAltBody(Environment *env,Ptree *rest,PortList &pv,Ptree* &defaultblock,bool reverse);
   bool parseAforBody(Environment *env,Ptree *rest,PortList &pv,Ptree* &defaultblock);
@@ -0,0 +1,102 @@
+/*
+ * QuickThreads -- Threads-building toolkit.
+ * Copyright (c) 1993 by David Keppel
+ *
+ * Permission to use, copy, modify and distribute this software and
+ * its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice and this notice
+ * appear in all copies.  This software is provided as a
+ * proof-of-concept and for demonstration purposes; there is no
+ * representation about the suitability of this software for any
+ * purpose.
+ */
+
+#ifndef QT_X86_64_H
+#define QT_X86_64_H
+
+typedef unsigned long qt_word_t;
+
+/* Thread's initial stack layout on the x86-64 (System V ABI):
+
+   non-varargs:
+
+   +---
+   | ret pc	=== `qt_start' on startup
+   +---
+   | %rbp
+   | %rbx
+   | %r12	=== `pu' on startup
+   | %r13	=== `pt' on startup
+   | %r14	=== `userf' on startup
+   | %r15	=== `only' on startup
+   | fpc	=== MXCSR (low word), x87 control word (high word)
+   +---					<--- qt_t.sp
+
+   Only the callee-save registers are saved: the ABI makes every
+   other integer, SSE and x87 register caller-save, so the compiler
+   has already spilled anything live around the call to `qt_block'.
+   The control bits of the MXCSR and the x87 control word are also
+   callee-save, so they are preserved per thread.
+
+   When a non-varargs thread is started, it ``returns'' to `qt_start',
+   which moves the arguments out of the callee-save registers and
+   calls the client's `only' function.
+
+   The saved-register block is 64 bytes and every saved stack pointer
+   is 16-byte aligned, so the helper and `only' functions are called
+   with the alignment that the ABI requires.
+
+   Varargs threads are not supported. */
+
+extern void qt_start (void);
+
+
+/* Stack must be 16-byte aligned at the point of a call. */
+#define QT_STKALIGN	(16)
+
+/* Hold the saved registers plus the return address. */
+#define QT_STKBASE	(8 * 8)
+
+
+/* Offsets (in words) of the saved state. */
+#define QT_FPC	0
+#define QT_R15	1
+#define QT_R14	2
+#define QT_R13	3
+#define QT_R12	4
+#define QT_RBX	5
+#define QT_RBP	6
+#define QT_PC	7
+
+#define QT_ONLY_INDEX	(QT_R15)
+#define QT_USER_INDEX	(QT_R14)
+#define QT_ARGT_INDEX	(QT_R13)
+#define QT_ARGU_INDEX	(QT_R12)
+
+/* Default MXCSR (all exceptions masked, round-to-nearest) and x87
+   control word (extended precision, all exceptions masked). */
+#define QT_FPC_INIT	((qt_word_t)0x1f80 | ((qt_word_t)0x037f << 32))
+
+
+/* Stack grows down.  The top of the stack is the first thing to
+   pop off (preincrement, postdecrement). */
+#define QT_GROW_DOWN
+
+extern void qt_error (void);
+
+#define QT_ARGS_MD(sto) \
+  (QT_SPUT (sto, QT_PC, qt_start), \
+   QT_SPUT (sto, QT_FPC, QT_FPC_INIT))
+
+#define QT_VARGS(sp, nbytes, vargs, pt, startup, vuserf, cleanup) \
+  (qt_error (), (qt_t *)0)
+
+/* Switch without a helper: save the current thread's sp in *oldsp,
+   resume newsp and, if clear is non-null, zero the byte it points to
+   once on the new stack.  See x86_64.S. */
+struct qt_t;
+extern void qt_swap (struct qt_t **oldsp, struct qt_t *newsp, char *clear);
+#define QT_SWAP(oldsp, newsp, clear) \
+  (qt_swap (oldsp, newsp, clear))
+
+#endif /* QT_X86_64_H */
@@ -13,22 +13,224 @@
 #define _CHANSUPPORT_H_
 
 #include <deque>
+#include <vector>
 #include <assert.h>
-#include <ext/hash_set>
-#include <ext/hash_map>
 
 namespace plasma {
 
+  class WaitSet;
+
+  // Identifies a port of an alt or afor block which is waiting on a channel:
+  // The block's wait-set, the position of the port statement and, for an
+  // afor, the loop iteration.  Since this header is included by Plasma code,
+  // in which port is a keyword, positions are called pos in parameters.
+  // Channels which support wait-sets provide a set_notify(const WaitPort &)
+  // method and call fire() when they wake the reader.  Other channels see a
+  // WaitPort as the waiting thread, in which case the wait-set falls back to
+  // polling every port.
+  struct WaitPort {
+    WaitSet  *_ws;
+    int       _port;
+    long      _index;
+
+    WaitPort() : _ws(0), _port(0), _index(0) {};
+    WaitPort(WaitSet &ws,int pos,long index) : _ws(&ws), _port(pos), _index(index) {};
+
+    bool empty() const { return !_ws; };
+    THandle thread() const;
+    operator THandle() const;
+    // Record in the wait-set that this port is ready.  Returns false if the
+    // thread should not be woken, because it isn't waiting in the block or
+    // another port has already woken it.
+    bool fire() const;
+  };
+
+  // The wait-set of an alt, afor or awhile block.  The block's ports are
+  // registered with their channels when the thread first sleeps.  A channel
+  // which becomes ready records its port here, so that upon waking, only the
+  // ports which fired need to be examined.  If more ports fire than can be
+  // recorded, or a channel doesn't support wait-sets, then polling() is true
+  // and every port must be examined.
+  //
+  // Only the first port to fire while the thread sleeps wakes it.  A
+  // multi-consumer channel whose first waiter has already been woken passes
+  // its data on to the next waiter, so that it isn't left unread if the first
+  // thread takes another port.
+  //
+  // An awhile block keeps its ports registered while it runs a port's body.
+  // Ports which fire in the meantime are recorded without waking the thread,
+  // and are examined when the block waits again.  The registrations are
+  // cleared by clear(), or by the destructor if the block is left early.
+  class WaitSet {
+  public:
+    WaitSet() : _thread(pCurThread()), _nfired(0), _registered(false), _poll(false), _waiting(false) {};
+    ~WaitSet() { if (!_regs.empty()) { pLock(); clear(); pUnlock(); } };
+
+    THandle thread() const { return _thread; };
+
+    bool registered() const { return _registered; };
+    void set_registered() { _registered = true; };
+    bool polling() const { return !_registered || _poll; };
+    void set_polling() { _poll = true; };
+
+    // Register a port with channel c.  The channel is remembered so that
+    // clear() can unregister it.
+    template <typename C>
+    void add(C *c,int pos,long index)
+    {
+      c->set_notify(WaitPort(*this,pos,index));
+      _regs.push_back(Reg(c,&Unregisterer<C>::unregister));
+    }
+    // Unregister all ports and forget all fired ports.
+    void clear();
+
+    // Record that a port is ready.  Returns true if the thread is asleep in
+    // wait() and should now be woken.
+    bool fire(int pos,long index);
+    // Remove the fired port which appears first in the block, i.e. the lowest
+    // port position, then the lowest afor index.  Returns false if no fired
+    // ports remain.
+    bool next(int &pos,long &index);
+
+    // Sleep until a port fires.  The cluster is locked before and after.
+    void wait() { _waiting = true; pSleep(); pLock(); _waiting = false; };
+
+  private:
+    enum { MaxFired = 16 };
+
+    struct Fired {
+      int  _port;
+      long _index;
+    };
+
+    typedef void (Unregister)(void *);
+
+    struct Reg {
+      Reg(void *c,Unregister *u) : _chan(c), _unregister(u) {};
+      void       *_chan;
+      Unregister *_unregister;
+    };
+    typedef std::vector<Reg,traceable_allocator<Reg> > Regs;
+
+    template <typename C>
+    struct Unregisterer {
+      static void unregister(void *c) { static_cast<C*>(c)->clear_notify(); };
+    };
+
+    THandle  _thread;
+    unsigned _nfired;
+    bool     _registered;
+    bool     _poll;
+    bool     _waiting;
+    Fired    _fired[MaxFired];
+    Regs     _regs;
+  };
+
+  inline void WaitSet::clear()
+  {
+    for (Regs::iterator i = _regs.begin(); i != _regs.end(); ++i) {
+      (i->_unregister)(i->_chan);
+    }
+    _regs.clear();
+    _nfired = 0;
+    _registered = false;
+    _poll = false;
+  }
+
+  inline bool WaitSet::fire(int pos,long index)
+  {
+    if (_nfired < MaxFired) {
+      _fired[_nfired]._port = pos;
+      _fired[_nfired]._index = index;
+      ++_nfired;
+    } else {
+      _poll = true;
+    }
+    bool w = _waiting;
+    _waiting = false;
+    return w;
+  }
+
+  inline bool WaitSet::next(int &pos,long &index)
+  {
+    if (!_nfired) {
+      return false;
+    }
+    unsigned m = 0;
+    for (unsigned i = 1; i != _nfired; ++i) {
+      if (_fired[i]._port < _fired[m]._port || 
+          (_fired[i]._port == _fired[m]._port && _fired[i]._index < _fired[m]._index)) {
+        m = i;
+      }
+    }
+    pos = _fired[m]._port;
+    index = _fired[m]._index;
+    _fired[m] = _fired[--_nfired];
+    return true;
+  }
+
+  inline THandle WaitPort::thread() const
+  {
+    return _ws->thread();
+  }
+
+  inline WaitPort::operator THandle() const
+  {
+    _ws->set_polling();
+    return _ws->thread();
+  }
+
+  inline bool WaitPort::fire() const
+  {
+    return (_ws) ? _ws->fire(_port,_index) : true;
+  }
+
+  // Blocking counts of a channel.  This is a virtual base of the reader and
+  // writer base classes, so that a channel has a single set of counts.  A
+  // channel is listed, for pDumpStats, from the first time that it blocks
+  // until it's destroyed.
+  class ChanStats {
+  public:
+    ChanStats() : _readblocks(0), _writeblocks(0), _next(0), _prev(0) {};
+    ChanStats(const ChanStats &x);
+    ~ChanStats() { unlink(); };
+    ChanStats &operator=(const ChanStats &x);
+
+    // Number of times a reader waited on this channel, including waits in
+    // alt blocks.
+    uint64 read_blocks() const { return _readblocks; };
+    // Number of times a writer blocked on this channel.
+    uint64 write_blocks() const { return _writeblocks; };
+
+    // The listed channels, most recently listed first.
+    static const ChanStats *first() { return _first; };
+    const ChanStats *next() const { return _next; };
+  protected:
+    void count_read() { PLASMA_STAT(if (!_readblocks++ && !_writeblocks) link()); };
+    void count_write() { PLASMA_STAT(if (!_writeblocks++ && !_readblocks) link()); };
+  private:
+    bool listed() const { return _readblocks || _writeblocks; };
+    void link();
+    void unlink();
+
+    uint64     _readblocks;
+    uint64     _writeblocks;
+    ChanStats *_next;
+    ChanStats *_prev;
+
+    static ChanStats *_first;
+  };
+
   // Base class for channels that allow multiple producers.  An actual
   // channel should inherit from this class and implement write, read, and get.
-  class MultiProducerChannel {
+  class MultiProducerChannel : public virtual ChanStats {
     typedef std::deque<THandle,traceable_allocator<THandle> > Writers;
   public:
-
     bool multiple_producers_allowed() const { return true; };
+
   protected:
-    void set_writenotify(THandle t) { _writers.push_back(t); };
-    void push_writer(THandle t) { _writers.push_front(t); };
+    void set_writenotify(THandle t) { count_write(); _writers.push_back(t); };
+    void push_writer(THandle t) { count_write(); _writers.push_front(t); };
     bool have_writers() const { return !_writers.empty(); };
     THandle next_writer() { THandle t = _writers.front(); _writers.pop_front(); return t; };
 
@@ -37,55 +239,129 @@ namespace plasma {
 
   // Base class for a simple channel that allows only one consumer but
   // multiple producers.
-  class SingleConsumerChannel {
+  class SingleConsumerChannel : public virtual ChanStats {
   public:
     SingleConsumerChannel() : _readt(0) {};
 
     // These are marked as non-mutex b/c they are used by alt, which already
     // does the locking.
-    void set_notify(THandle t) { assert(!_readt); _readt = t; };
-    void clear_notify() { _readt = 0; };
+    void set_notify(THandle t) { displace(); assert(!_readt); count_read(); _readt = t; };
+    void set_notify(const WaitPort &p) { set_notify(p.thread()); _readp = p; };
+    void clear_notify() { _readt = 0; _readp = WaitPort(); };
 
     bool multiple_consumers_allowed() const { return false; };
+
   protected:
     // Do we have a waiting reader?
     bool have_reader() const { return _readt; };
-    THandle notify_reader() { THandle t = _readt; _readt = 0; return t; };
+    THandle notify_reader() 
+    { 
+      THandle t = _readt; 
+      _readt = 0; 
+      bool wake = _readp.fire(); 
+      _readp = WaitPort(); 
+      return (wake) ? t : 0; 
+    };
 
   private:
+    // If the port of an awhile block is still registered while its thread
+    // waits on the channel in some other way, hand the port back to the
+    // wait-set, which will check it again.
+    void displace()
+    {
+      if (!_readp.empty()) {
+        _readp.fire();
+        _readp = WaitPort();
+        _readt = 0;
+      }
+    }
+
     THandle    _readt;
+    WaitPort   _readp;     // Port of the reader, if it's an alt block.
   };
 
-  struct HashTHandle {
-    size_t operator()( THandle t ) const { return (size_t)t; };
+  // Registration of a consumer waiting on a multi-consumer channel.  Each
+  // channel keeps its waiting consumers in a FIFO of these nodes.  Each thread
+  // also keeps a list of its own nodes, so that a consumer can find its
+  // registration with a channel by searching whichever list is shorter.  Nodes
+  // are pooled, so registration does not normally allocate.
+  struct WaitNode {
+    WaitNode  *_next;     // Channel's FIFO.
+    WaitNode  *_prev;
+    WaitNode  *_tnext;    // Thread's list.
+    WaitNode  *_tprev;
+    void      *_chan;     // Owning channel.
+    THandle    _thread;
+    WaitPort   _port;
+    Timer      _waker;    // Used by clocked channels to delay the wakeup.
   };
 
-  typedef __gnu_cxx::hash_set<THandle,HashTHandle> ConInfo;
+  // FIFO of waiting consumers.  All operations are O(1), except for finding
+  // a thread's node, which is linear in the smaller of the number of
+  // consumers waiting on the channel and the number of channels on which the
+  // thread is waiting.  Thus, a thread waiting on many channels, each of
+  // which has few consumers, or many consumers waiting on one channel, can
+  // register and unregister in constant time.  Copying a list does not copy
+  // its waiters.
+  class WaitList {
+  public:
+    WaitList() : _head(0), _tail(0), _size(0) {};
+    WaitList(const WaitList &) : _head(0), _tail(0), _size(0) {};
+    ~WaitList() { clear(); };
+    WaitList &operator=(const WaitList &) { return *this; };
+
+    bool empty() const { return !_head; };
+    WaitNode *front() const { return _head; };
+
+    // Register t with channel c, unless it's already registered, in which
+    // case the existing node is returned.  If the existing node belongs to
+    // another wait-set, e.g. that of an enclosing awhile block, its port is
+    // fired and the node is given to p.
+    WaitNode *add(void *c,THandle t,const WaitPort &p);
+    // The node of t for channel c, or 0 if there is none.
+    WaitNode *find(void *c,THandle t) const;
+    // Unregister a node and return it to the pool, unless the pool is full.
+    void remove(WaitNode *n);
+    // Remove the first waiter which should be woken, firing its port, and
+    // return its thread, or 0 if there is none.  Waiters passed over, i.e.
+    // alt blocks already woken by another port or awhile blocks which aren't
+    // waiting, are removed and their ports fired, so they'll examine this
+    // channel when they next check.
+    THandle pop_front();
+    void clear();
+
+  private:
+    WaitNode *_head;
+    WaitNode *_tail;
+    unsigned  _size;
+  };
 
   // Base class for a simple channel that allows multiple consumers and multiple
-  // producers.  Note:  The order in which multiple consumers will be satisfied
-  // is non-deterministic.
-  class MultiConsumerChannel {
+  // producers.  Waiting consumers are satisfied in the order in which they
+  // started waiting.
+  class MultiConsumerChannel : public virtual ChanStats {
 
   public:
-    MultiConsumerChannel(){};
-
     // These are marked as non-mutex b/c they are used by alt, which already
     // does the locking.
-    void set_notify(THandle t) { _cons.insert(t); };
+    void set_notify(THandle t) { count_read(); _cons.add(this,t,WaitPort()); };
+    void set_notify(const WaitPort &p) { count_read(); _cons.add(this,p.thread(),p); };
     // This clears the notification for the current thread- should only be called by
     // reader threads.
-    void clear_notify() { _cons.erase(_cons.find(pCurThread())); };
+    void clear_notify() { if (WaitNode *n = _cons.find(this,pCurThread())) { _cons.remove(n); } };
 
     bool multiple_consumers_allowed() const { return true; };
+
   protected:
     // Do we have a waiting reader?
     bool have_reader() const { return !_cons.empty(); };
-    // This gets the next reader in a non-deterministic fashion.
-    THandle notify_reader() { THandle t = *(_cons.begin()); _cons.erase(_cons.begin()); return t; };
+    // This gets the reader which has waited the longest, skipping alt blocks
+    // which another channel has already woken.  Returns 0 if every waiter was
+    // skipped, so the caller must check the result.
+    THandle notify_reader() { return _cons.pop_front(); };
 
   private:
-    ConInfo _cons;
+    WaitList _cons;
   };
 
   // Base class for single-data item channels.  This must be first on the list
@@ -119,7 +395,7 @@ namespace plasma {
   //
   class Timeout {
   public:
-    Timeout(ptime_t d) : _ready(false), _delay(d), _readt(0), _writet(0) {};
+    Timeout(ptime_t d) : _ready(false), _delay(d), _readt(0) {};
 
     ptime_t delay() const { return _delay; };
     void setDelay(ptime_t d) { _delay = d; };
@@ -130,6 +406,7 @@ namespace plasma {
     // These are marked as non-mutex b/c they are used by alt, which already
     // does the locking.
     void set_notify(THandle t);
+    void set_notify(const WaitPort &p) { set_notify(p.thread()); _readp = p; };
     THandle clear_notify();
 
     bool multiple_producers_allowed() const { return false; };
@@ -137,18 +414,19 @@ namespace plasma {
     void *get_source_channel() const { return 0; };
     void set_source_channel(void *) { };
   private:
-    friend void timeout(void *a);
+    friend THandle timeout(void *a);
     THandle reset();
 
     bool       _ready;
     ptime_t    _delay;
     THandle    _readt;
-    THandle    _writet;
+    WaitPort   _readp;     // Port of the reader, if it's an alt block.
+    Timer      _timer;     // Wakes the reader after the delay.
   };
 
   // Non-templated implementation class used by ClockChan- do not use this
   // directly.
-  class ClockChanImpl {
+  class ClockChanImpl : public virtual ChanStats {
   public:
     ClockChanImpl(ptime_t p,ptime_t s,unsigned maxsize);
     ClockChanImpl(const ClockChanImpl &);
@@ -175,6 +453,7 @@ namespace plasma {
 
     void *get_source_channel() const { return _source_channel; };
     void set_source_channel(void *sc) { _source_channel = sc; };    
+
   private:
     unsigned allowed_size() const { return (!_maxsize) ? 1 : _maxsize; };
 
@@ -194,29 +473,21 @@ namespace plasma {
 
     bool have_reader() const { return _readt; };
     void set_notify(THandle t);
+    void set_notify(const WaitPort &p);
     void clear_notify();
     void delayed_wakeup(bool current_data);
     void delayed_reader_wakeup();
     void start_waker();
     THandle reset();
     void cancel_waker();
-    int delay() const { return _delay; };
 
     bool multiple_consumers_allowed() const { return false; };    
   private:
-    THandle    _waket;     // Thread which wakes reader at the correct time.
-    int        _delay;     // Stores delay time for waker.
+    Timer      _waker;     // Wakes reader at the correct time.
     THandle    _readt;     // Read thread.
+    WaitPort   _readp;     // Port of the reader, if it's an alt block.
   };
 
-  struct MClk {
-    THandle    _tinfo;
-    THandle    _waker;
-
-    MClk(THandle t) : _tinfo(t), _waker(0) {};
-  };
-  typedef __gnu_cxx::hash_map<THandle,MClk,HashTHandle> MClkInfo;
-
   // Base class used for multi-consumer clocked channels.
   // If _broadcast is true, we will deliver a wakeup to all
   // registered consumers, rather than just one.
@@ -226,19 +497,24 @@ namespace plasma {
 
     void set_broadcast() { _broadcast = true; };
     bool have_reader() const { return !_cons.empty(); };
-    void set_notify(THandle t);
+    void set_notify(THandle t) { add_notify(t,WaitPort()); };
+    void set_notify(const WaitPort &p) { add_notify(p.thread(),p); };
     void clear_notify();
-    void cancel_waker(MClkInfo::iterator iter);
+    void cancel_waker(WaitNode *n);
     // This wakes up the next available reader.
     void delayed_wakeup(bool current_data);
     void delayed_reader_wakeup();
-    void start_waker(MClkInfo::iterator);
-    THandle reset(MClkInfo::iterator);
+    void start_waker(WaitNode *n);
+    THandle reset(WaitNode *n);
 
     bool multiple_consumers_allowed() const { return true; };    
   private:
+    friend THandle mc_delayed_waker(void *a);
+
+    void add_notify(THandle t,const WaitPort &p);
+
     bool        _broadcast;
-    MClkInfo    _cons;
+    WaitList    _cons;
   };
 
 }
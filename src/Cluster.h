@@ -12,6 +12,7 @@
 #define _CLUSTER_H_
 
 #include <signal.h>
+#include <time.h>
 
 #include "Thread.h"
 #include "ProcQ.h"
@@ -26,6 +27,8 @@ namespace plasma {
     Cluster();
     void init(const ConfigParms &);
     void reset(Proc *p);
+    // Release the preemption timer.  Called once the scheduler has finished.
+    void shutdown();
 
     // Main entry point.  This runs until there are no more user threads.
     void scheduler();
@@ -49,6 +52,8 @@ namespace plasma {
 
     // Wake specified thread.  This just adds the thread back to the ready queue.
     void wake(THandle t);
+    // Wake specified thread and switch to it directly, if possible.
+    void handoff(THandle t);
     // Wake a busy processor (used with busysleep).
     void busywake(THandle t);
 
@@ -58,6 +63,10 @@ namespace plasma {
     // in Interface.C so that everything else has 0 as being lowest.
     void set_priority(unsigned p);
     unsigned get_priority() const;
+    // Set the deadline of the current thread, which yields, or of another
+    // thread.
+    void set_deadline(ptime_t d);
+    void set_deadline(THandle t,ptime_t d);
 
     // Add and remove processor objects.
     // Sets state to Running.
@@ -86,6 +95,10 @@ namespace plasma {
     static void nopreempt();        // switch off alarm preemption
     static void preempt();          // switch on alarm preemption
 
+    // Safe point for polled preemption:  If the timeslice has expired, switch
+    // to the next ready thread.  Must be called unlocked, from a user thread.
+    void preempt_point();
+
     void setCur(THandle t);
     THandle curThread() const;
 
@@ -100,6 +113,9 @@ namespace plasma {
     friend void *switch_block(qt_t *sptr, void*, void *old);
 
     bool in_scheduler() const;
+#ifdef QT_SWAP
+    char *unlock_flag(Thread *);
+#endif
 
     static bool init();
 
@@ -119,8 +135,18 @@ namespace plasma {
     // Add thread back to its processor, awakening the thread if not busy or
     // waking thread is of higher priority.
     void add_thread_to_proc(Thread *t);
+    // Schedule an idle processor sharing p's ready queue if p can't run its
+    // queued threads.
+    bool steal_work(Proc *p);
+    // Impose the timeslice on a coalesced busy period.
+    bool split_busy(Proc *p);
+    // Release a finishing thread's join counter, if it has one.
+    void release_join(Thread *t);
     // Internal routine for busy thread setup.
-    void do_busy(ptime_t);    
+    void do_busy(ptime_t,ptime_t slice = 0);
+
+    // Count a switch to the specified thread.
+    void count_switch(Thread *);
 
     // Execute thread new, saving data in old.
     void exec_ready(THandle newthread,THandle oldthread);
@@ -129,15 +155,27 @@ namespace plasma {
     void exec_block();
 
     friend void resetalarm();
+    friend void pollpreempt(int);
+    friend void setpolltimer();
+
+    void preempt_now();
 
     void print_procs(std::ostream &) const;
     void print_procs() const;
 
     static bool     _preemptOkay;      // Is preemption allowed?
+    static bool     _pollPreempt;      // Preempt only at safe points?
+    static volatile sig_atomic_t _preemptPending; // Timeslice expired (polled mode).
     static unsigned _timeslice;        // Time slice period in usec.
     static ptime_t  _busyts;           // Busy timeslice in time units.
+#   if defined(CLOCK_PROCESS_CPUTIME_ID) && !defined(__CYGWIN__)
+    static timer_t  _polltimer;        // CPU-time timer (polled mode).
+    static bool     _hasPolltimer;     // Set if _polltimer was created.
+#   endif
 
     ProcQ      _procs;                 // Queue of processors we know about.
+    TVect      _tcohort;               // Threads woken at the current time.
+    PVect      _pcohort;               // Processors whose busy time ends at the current time.
     Proc      *_curproc;               // Current processor.
     Thread     _main;                  // Main thread (the scheduler loop itself).
     Thread    *_cur;                   // Current thread.
@@ -162,6 +200,13 @@ namespace plasma {
     return _kernel;
   }
 
+  inline void Cluster::preempt_point()
+  {
+    if (_preemptPending) {
+      preempt_now();
+    }
+  }
+
   inline void Cluster::setCur(THandle t)
   {
     _cur = t;
@@ -0,0 +1,608 @@
+//
+// Copyright (C) 2005 by Freescale Semiconductor Inc.  All rights reserved.
+//
+// You may distribute under the terms of the Artistic License, as specified in
+// the COPYING file.
+//
+//
+// Event queues used by the System object to store delayed threads and busy
+// processors, ordered by their end-time.
+//
+// Two implementations are available and are selected at run-time:
+//
+// Heap:      A binary heap (std::priority_queue).  O(log n) insertion and
+//            removal.
+//
+// Calendar:  A calendar queue (R. Brown, "Calendar Queues: A Fast O(1)
+//            Priority Queue Implementation for the Simulation Event Set
+//            Problem", CACM 31(10), 1988).  Times are hashed into an array of
+//            buckets, each covering a fixed width of time, so insertion and
+//            extraction of near-future events are O(1) amortized.  The
+//            number of buckets and their width are adjusted as the queue
+//            grows and shrinks.  All events at the same time are kept
+//            together in a single group, in FIFO order, so that a whole
+//            cohort can be inserted and removed cheaply.
+//
+// The element type must supply an endtime() method.  The heap always uses
+// the element's current end-time.  The calendar queue records the end-time
+// when the element is inserted; if an element's end-time has moved later by
+// the time it reaches the front of the queue, it is simply re-inserted at its
+// new time.  If an element's end-time moves earlier, the owner must call
+// reschedule():  The calendar queue removes it and re-inserts it and the heap
+// moves it up to its new position.  For the calendar queue, the element must
+// also supply calgroup()/setCalgroup() and calindex()/setCalindex(), which
+// record where it is stored.  An element which is not in the queue has a null
+// group.
+//
+
+#ifndef _EVENTQUEUE_H_
+#define _EVENTQUEUE_H_
+
+#include <iostream>
+#include <vector>
+#include <queue>
+#include <algorithm>
+
+#include "Interface.h"
+
+namespace plasma {
+
+  // Returns true if x's time is greater than y's time.
+  template <class T1,class T2>
+  struct greater_time {
+    bool operator()(const T1 *x,const T2 *y) const { return x->endtime() > y->endtime(); };
+  };
+
+  template <class T>
+  class CalendarQueue {
+  public:
+    CalendarQueue();
+    ~CalendarQueue();
+
+    bool empty() const { return !_size; };
+    unsigned size() const { return _size; };
+
+    // Add an element at its current end-time.
+    void push(T *x) { push(x,x->endtime()); };
+    // Time of the first element.  Queue must not be empty.
+    ptime_t top_time();
+    // First element.  Queue must not be empty.
+    T *top();
+    // Remove the first element.
+    void pop();
+    // Remove all elements with a time <= t, appending them to v.  f is
+    // applied to each element as it is removed.
+    template <class V,class F> void pop_all(ptime_t t,V &v,F f);
+    // An element's end-time has moved earlier:  It is removed and inserted at
+    // its new time.  Does nothing if the element isn't in the queue.
+    void reschedule(T *x);
+
+    void print(std::ostream &) const;
+
+  private:
+    typedef std::vector<T*,traceable_allocator<T*> > Items;
+
+    // All elements with the same time, in insertion order.  A removed element
+    // leaves a null entry; _head is always the first remaining element.
+    // Groups are recycled via a free list so that their storage is reused.
+    struct Group {
+      ptime_t   _time;
+      unsigned  _head;
+      unsigned  _live;         // Number of elements remaining.
+      Items     _items;
+    };
+
+    // A bucket holds groups sorted by descending time, so that the
+    // earliest group is at the back.
+    typedef std::vector<Group*> Bucket;
+    typedef std::vector<Bucket> Buckets;
+
+    void push(T *x,ptime_t t);
+    Group *min_group();
+    Group *new_group(ptime_t t);
+    void free_group(Group *g);
+    void remove_group(Group *g);
+    void resize(unsigned nb);
+    void set_position(ptime_t t);
+    unsigned index(ptime_t t) const { return (unsigned)(t / _width) & (_buckets.size()-1); };
+
+    Buckets   _buckets;        // Power-of-two number of buckets.
+    ptime_t   _width;          // Time covered by each bucket.
+    unsigned  _last;           // Bucket of the last minimum found.
+    ptime_t   _buckettop;      // End of the time range of _last in the current "year".
+    Group    *_min;            // Cached minimum group, or 0 if unknown.
+    unsigned  _size;           // Number of elements.
+    unsigned  _ngroups;        // Number of distinct times.
+    std::vector<Group*> _free; // Free list of groups.
+  };
+
+  template <class T>
+  class HeapQueue : public std::priority_queue<T*,std::vector<T*,traceable_allocator<T*> >,greater_time<T,T> >
+  {
+  public:
+    ptime_t top_time() const { return this->top()->endtime(); };
+    template <class V,class F> void pop_all(ptime_t t,V &v,F f);
+    // An element's end-time has moved earlier.  Does nothing if the element
+    // isn't in the queue.
+    void reschedule(T *x);
+    void print(std::ostream &) const;
+  };
+
+  // Wrapper which dispatches to the selected implementation.
+  template <class T>
+  class EventQueue {
+  public:
+    EventQueue() : _kind(ConfigParms::HeapQueue) {};
+
+    void setKind(ConfigParms::QueueKind k) { assert(empty()); _kind = k; };
+
+    bool empty() const;
+    unsigned size() const;
+    // Time of the first element.  Queue must not be empty.
+    ptime_t top_time();
+    // First element.  Queue must not be empty.
+    T *top();
+    // Remove the first element.
+    void pop();
+    // Add an element at its current end-time.
+    void push(T *x);
+    // Remove all elements with a time <= t, appending them to v in the
+    // order in which they would have been popped.  f is applied to each
+    // element as it is removed, before the next element is examined, since
+    // it may change the end-times seen by the heap.
+    template <class V,class F> void pop_all(ptime_t t,V &v,F f);
+    // An element's end-time has moved earlier:  Make sure that it is found at
+    // its new time.
+    void reschedule(T *x);
+
+    void print(std::ostream &) const;
+
+  private:
+    ConfigParms::QueueKind _kind;
+    HeapQueue<T>           _heap;
+    CalendarQueue<T>       _cal;
+  };
+
+  //////////////////////////////////////////////////////////////////////////////
+  //
+  // Implementation.
+  //
+  //////////////////////////////////////////////////////////////////////////////
+
+  /////////////// CalendarQueue ///////////////
+
+  // Initial number of buckets.  This must be a power of two.
+  const unsigned CalendarMinBuckets = 16;
+
+  // Number of groups sampled to estimate a new bucket width.
+  const unsigned CalendarSample = 25;
+
+  template <class T>
+  CalendarQueue<T>::CalendarQueue() :
+    _buckets(CalendarMinBuckets),
+    _width(1),
+    _last(0),
+    _buckettop(1),
+    _min(0),
+    _size(0),
+    _ngroups(0)
+  {
+  }
+
+  template <class T>
+  CalendarQueue<T>::~CalendarQueue()
+  {
+    for (typename Buckets::iterator i = _buckets.begin(); i != _buckets.end(); ++i) {
+      for (typename Bucket::iterator j = i->begin(); j != i->end(); ++j) {
+        delete *j;
+      }
+    }
+    for (typename std::vector<Group*>::iterator i = _free.begin(); i != _free.end(); ++i) {
+      delete *i;
+    }
+  }
+
+  template <class T>
+  typename CalendarQueue<T>::Group *CalendarQueue<T>::new_group(ptime_t t)
+  {
+    Group *g;
+    if (_free.empty()) {
+      g = new Group;
+    } else {
+      g = _free.back();
+      _free.pop_back();
+    }
+    g->_time = t;
+    g->_head = 0;
+    g->_live = 0;
+    ++_ngroups;
+    return g;
+  }
+
+  template <class T>
+  void CalendarQueue<T>::free_group(Group *g)
+  {
+    // The items have already been zeroed by pop(), so the storage may be kept
+    // for the next group without holding on to stale pointers.
+    g->_items.clear();
+    _free.push_back(g);
+    --_ngroups;
+  }
+
+  // Remove a group whose elements have all been removed.
+  template <class T>
+  void CalendarQueue<T>::remove_group(Group *g)
+  {
+    Bucket &b = _buckets[index(g->_time)];
+    typename Bucket::iterator i = std::find(b.begin(),b.end(),g);
+    assert(i != b.end());
+    b.erase(i);
+    if (_min == g) {
+      _min = 0;
+    }
+    free_group(g);
+  }
+
+  // Make the scan start at the bucket containing time t.
+  template <class T>
+  inline void CalendarQueue<T>::set_position(ptime_t t)
+  {
+    _last = index(t);
+    _buckettop = (t / _width) * _width + _width;
+  }
+
+  template <class T>
+  void CalendarQueue<T>::push(T *x,ptime_t t)
+  {
+    if (!_size) {
+      set_position(t);
+    } else if (t < _buckettop - _width) {
+      // Earlier than the current scan position, so restart the scan there.
+      set_position(t);
+    }
+    Bucket &b = _buckets[index(t)];
+    // Search from the back, since that is where the earliest times are and
+    // most insertions are for the near future.
+    typename Bucket::iterator i = b.end();
+    while (i != b.begin() && (*(i-1))->_time < t) {
+      --i;
+    }
+    Group *g;
+    if (i != b.begin() && (*(i-1))->_time == t) {
+      g = *(i-1);
+    } else {
+      g = new_group(t);
+      b.insert(i,g);
+      if (_min && t < _min->_time) {
+        _min = 0;
+      }
+    }
+    x->setCalgroup(g);
+    x->setCalindex(g->_items.size());
+    g->_items.push_back(x);
+    ++g->_live;
+    ++_size;
+    if (_ngroups > 2*_buckets.size()) {
+      resize(2*_buckets.size());
+    }
+  }
+
+  // Finds the earliest group, scanning forward through the buckets one "day"
+  // at a time.  If a whole "year" is scanned without success, the events are
+  // sparse, so we search directly for the minimum.
+  template <class T>
+  typename CalendarQueue<T>::Group *CalendarQueue<T>::min_group()
+  {
+    if (_min) {
+      return _min;
+    }
+    unsigned i = _last;
+    ptime_t top = _buckettop;
+    for (unsigned n = 0; n != _buckets.size(); ++n) {
+      Bucket &b = _buckets[i];
+      if (!b.empty() && b.back()->_time < top) {
+        _last = i;
+        _buckettop = top;
+        return (_min = b.back());
+      }
+      i = (i+1) & (_buckets.size()-1);
+      top += _width;
+    }
+    Group *g = 0;
+    for (typename Buckets::iterator b = _buckets.begin(); b != _buckets.end(); ++b) {
+      if (!b->empty() && (!g || b->back()->_time < g->_time)) {
+        g = b->back();
+      }
+    }
+    assert(g);
+    set_position(g->_time);
+    return (_min = g);
+  }
+
+  template <class T>
+  ptime_t CalendarQueue<T>::top_time()
+  {
+    top();
+    return min_group()->_time;
+  }
+
+  // Returns the first element.  If its end-time has moved later since it was
+  // inserted, it is moved to its new time and we look again.
+  template <class T>
+  T *CalendarQueue<T>::top()
+  {
+    while (true) {
+      Group *g = min_group();
+      T *x = g->_items[g->_head];
+      ptime_t t = x->endtime();
+      if (t <= g->_time) {
+        return x;
+      }
+      pop();
+      push(x,t);
+    }
+  }
+
+  template <class T>
+  void CalendarQueue<T>::pop()
+  {
+    Group *g = min_group();
+    g->_items[g->_head]->setCalgroup(0);
+    g->_items[g->_head++] = 0;
+    --_size;
+    if (!--g->_live) {
+      Bucket &b = _buckets[_last];
+      assert(b.back() == g);
+      b.pop_back();
+      free_group(g);
+      _min = 0;
+      if (_buckets.size() > CalendarMinBuckets && _ngroups < _buckets.size()/2) {
+        resize(_buckets.size()/2);
+      }
+    } else {
+      while (!g->_items[g->_head]) {
+        ++g->_head;
+      }
+    }
+  }
+
+  template <class T>
+  void CalendarQueue<T>::reschedule(T *x)
+  {
+    Group *g = (Group*)x->calgroup();
+    if (!g) {
+      return;
+    }
+    unsigned i = x->calindex();
+    assert(g->_items[i] == x);
+    g->_items[i] = 0;
+    x->setCalgroup(0);
+    --_size;
+    if (!--g->_live) {
+      remove_group(g);
+    } else {
+      while (!g->_items[g->_head]) {
+        ++g->_head;
+      }
+    }
+    push(x);
+  }
+
+  // Rebuild the calendar with nb buckets.  The new width is three times the
+  // average separation of the earliest groups, ignoring outliers, as
+  // suggested by Brown.
+  template <class T>
+  void CalendarQueue<T>::resize(unsigned nb)
+  {
+    std::vector<Group*> groups;
+    groups.reserve(_ngroups);
+    for (typename Buckets::iterator b = _buckets.begin(); b != _buckets.end(); ++b) {
+      groups.insert(groups.end(),b->begin(),b->end());
+      b->clear();
+    }
+
+    unsigned ns = std::min((unsigned)groups.size(),CalendarSample);
+    if (ns > 1) {
+      std::vector<ptime_t> times;
+      times.reserve(groups.size());
+      for (typename std::vector<Group*>::iterator i = groups.begin(); i != groups.end(); ++i) {
+        times.push_back((*i)->_time);
+      }
+      std::partial_sort(times.begin(),times.begin()+ns,times.end());
+      ptime_t avg = (times[ns-1] - times[0]) / (ns-1);
+      ptime_t sum = 0;
+      unsigned n = 0;
+      for (unsigned i = 1; i != ns; ++i) {
+        ptime_t sep = times[i] - times[i-1];
+        if (sep <= 2*avg) {
+          sum += sep;
+          ++n;
+        }
+      }
+      _width = (n && sum) ? (3*sum)/n : 1;
+      if (!_width) {
+        _width = 1;
+      }
+    }
+
+    _buckets.resize(nb);
+    Group *m = 0;
+    for (typename std::vector<Group*>::iterator i = groups.begin(); i != groups.end(); ++i) {
+      if (!m || (*i)->_time < m->_time) {
+        m = *i;
+      }
+      Bucket &b = _buckets[index((*i)->_time)];
+      typename Bucket::iterator j = b.end();
+      while (j != b.begin() && (*(j-1))->_time < (*i)->_time) {
+        --j;
+      }
+      b.insert(j,*i);
+    }
+    _min = 0;
+    if (m) {
+      set_position(m->_time);
+    }
+  }
+
+  // Whole groups are removed at once.  Any element whose end-time has moved
+  // later is set aside and re-inserted once its group has been removed, so
+  // that the group is not disturbed while we walk it.
+  template <class T> template <class V,class F>
+  void CalendarQueue<T>::pop_all(ptime_t t,V &v,F f)
+  {
+    Items later;
+    while (_size && min_group()->_time <= t) {
+      Group *g = min_group();
+      for (unsigned i = g->_head; i != g->_items.size(); ++i) {
+        T *x = g->_items[i];
+        if (!x) {
+          continue;
+        }
+        x->setCalgroup(0);
+        if (x->endtime() > g->_time) {
+          later.push_back(x);
+        } else {
+          v.push_back(x);
+          f(x);
+        }
+        g->_items[i] = 0;
+      }
+      _size -= g->_live;
+      Bucket &b = _buckets[_last];
+      assert(b.back() == g);
+      b.pop_back();
+      free_group(g);
+      _min = 0;
+      for (typename Items::iterator i = later.begin(); i != later.end(); ++i) {
+        push(*i);
+      }
+      later.clear();
+    }
+    if (_buckets.size() > CalendarMinBuckets && _ngroups < _buckets.size()/2) {
+      resize(_buckets.size()/2);
+    }
+  }
+
+  template <class T>
+  void CalendarQueue<T>::print(std::ostream &o) const
+  {
+    int index = 0;
+    for (typename Buckets::const_iterator b = _buckets.begin(); b != _buckets.end(); ++b, ++index) {
+      for (typename Bucket::const_reverse_iterator g = b->rbegin(); g != b->rend(); ++g) {
+        o << index << ":  Time:  " << (*g)->_time << ", " << (*g)->_live << " element(s)\n";
+      }
+    }
+  }
+
+  /////////////// HeapQueue ///////////////
+
+  template <class T> template <class V,class F>
+  void HeapQueue<T>::pop_all(ptime_t t,V &v,F f)
+  {
+    while (!this->empty() && top_time() <= t) {
+      T *x = this->top();
+      this->pop();
+      v.push_back(x);
+      f(x);
+    }
+  }
+
+  // The prefix of a heap ending at the element is itself a heap, so pushing
+  // that prefix sifts the element up to where its new time belongs.
+  template <class T>
+  void HeapQueue<T>::reschedule(T *x)
+  {
+    typename HeapQueue::container_type::iterator i = std::find(this->c.begin(),this->c.end(),x);
+    if (i != this->c.end()) {
+      std::push_heap(this->c.begin(),i+1,this->comp);
+    }
+  }
+
+  template <class T>
+  void HeapQueue<T>::print(std::ostream &o) const
+  {
+    int index = 0;
+    for (typename HeapQueue::container_type::const_iterator i = this->c.begin(); i != this->c.end(); ++i, ++index) {
+      o << index << ":  End-time:  " << (*i)->endtime() << "\n";
+    }
+  }
+
+  /////////////// EventQueue ///////////////
+
+  template <class T>
+  inline bool EventQueue<T>::empty() const
+  {
+    return (_kind == ConfigParms::HeapQueue) ? _heap.empty() : _cal.empty();
+  }
+
+  template <class T>
+  inline unsigned EventQueue<T>::size() const
+  {
+    return (_kind == ConfigParms::HeapQueue) ? _heap.size() : _cal.size();
+  }
+
+  template <class T>
+  inline ptime_t EventQueue<T>::top_time()
+  {
+    return (_kind == ConfigParms::HeapQueue) ? _heap.top_time() : _cal.top_time();
+  }
+
+  template <class T>
+  inline T *EventQueue<T>::top()
+  {
+    return (_kind == ConfigParms::HeapQueue) ? _heap.top() : _cal.top();
+  }
+
+  template <class T>
+  inline void EventQueue<T>::pop()
+  {
+    if (_kind == ConfigParms::HeapQueue) {
+      _heap.pop();
+    } else {
+      _cal.pop();
+    }
+  }
+
+  template <class T>
+  inline void EventQueue<T>::push(T *x)
+  {
+    if (_kind == ConfigParms::HeapQueue) {
+      _heap.push(x);
+    } else {
+      _cal.push(x);
+    }
+  }
+
+  template <class T> template <class V,class F>
+  inline void EventQueue<T>::pop_all(ptime_t t,V &v,F f)
+  {
+    if (_kind == ConfigParms::HeapQueue) {
+      _heap.pop_all(t,v,f);
+    } else {
+      _cal.pop_all(t,v,f);
+    }
+  }
+
+  template <class T>
+  inline void EventQueue<T>::reschedule(T *x)
+  {
+    if (_kind == ConfigParms::CalendarQueue) {
+      _cal.reschedule(x);
+    } else {
+      _heap.reschedule(x);
+    }
+  }
+
+  template <class T>
+  void EventQueue<T>::print(std::ostream &o) const
+  {
+    if (_kind == ConfigParms::HeapQueue) {
+      _heap.print(o);
+    } else {
+      _cal.print(o);
+    }
+  }
+
+}
+
+#endif
@@ -17,8 +17,18 @@
 
 #include <functional>
 #include <vector>
+#include <iosfwd>
 #include <assert.h>
 
+// Scheduler statistics (see pStats) are maintained unless the runtime and the
+// program are compiled with PLASMA_NO_STATS defined, in which case they are
+// never updated and read as zero.
+#ifdef PLASMA_NO_STATS
+#  define PLASMA_STAT(x)
+#else
+#  define PLASMA_STAT(x) x
+#endif
+
 namespace plasma {
 
   class Thread;
@@ -34,22 +44,41 @@ namespace plasma {
   typedef long long int int64;
   typedef uint64 ptime_t;
 
+  // Deadline of a thread which has none.
+  const ptime_t NoDeadline = ~(ptime_t)0;
+
   //
   // This defines parameters that are adjustable by the user.
   //
   struct ConfigParms
   {
+    // Implementations available for the event queues which hold delayed
+    // threads and busy processors.
+    enum QueueKind { HeapQueue, CalendarQueue };
+    // Scheduling policies available for processors (see SchedPolicy.h).
+    enum SchedKind { PrioritySched, EdfSched, WfqSched };
+
     int      _stacksize;      // size of thread stack
     bool     _verbose;        // verbosity flag
     bool     _preempt;        // preemption allowed.
+    bool     _pollpreempt;    // Preempt only at safe points (see pPreemptPoint).
     unsigned _timeslice;      // Time slice length in usec.
     int      _numpriorities;  // Number of supported priorities.
     bool     _busyokay;       // Indicates that pBusy is legal- default is false.
     ptime_t  _simtimeslice;   // Size of time slice for low-priority threads in pBusy.
+    QueueKind _eventqueue;    // Event queue implementation used by the time model.
+    SchedKind _schedpolicy;   // Default scheduling policy of processors.
+    unsigned _stackpool;      // Max number of idle stacks kept for reuse.
+    bool     _stackguard;     // Use mmap'd stacks with a guard page.
+    const char *_statsfile;   // If set, statistics are written here as JSON at exit.
+    const char *_tracefile;   // If set, events are traced and written here at exit.
+    unsigned _tracesize;      // Number of events kept in the trace buffer.
 
     ConfigParms();
   };
 
+  struct ProcStats;
+
   // A Processor object encapsulates a Proc object and provides a means for
   // users to group threads together.  A processor may be given a name.  The
   // name string ptr is stored only- no copying is done, so it's legal to compare
@@ -62,10 +91,14 @@ namespace plasma {
     Proc *operator()() { return _proc; };
     const char *name() const;
     void setName(const char *);
+    // Select the scheduling policy of the processor and of any processors
+    // sharing its ready queue.  The processor must have no ready threads.
+    void setPolicy(ConfigParms::SchedKind);
     bool operator==(const Processor &p) const { return _proc == p._proc; };
     bool operator!=(const Processor &p) const { return _proc != p._proc; };
 
     friend struct HashProc;
+    friend ProcStats pStats(const Processor &);
   private:
     Proc *_proc;
   };
@@ -142,6 +175,12 @@ namespace plasma {
   // Wake the specified thread, giving it the handle values.
   void pWake(THandle);
 
+  // Wake the specified thread and switch to it immediately, if it's sleeping
+  // on the current processor and its priority is not lower than the current
+  // thread's.  The current thread is placed back onto the ready queue, as
+  // with pYield.  Otherwise, this is the same as pWake.
+  void pHandoff(THandle);
+
   // Wake a busy thread that was made busy by pBusySleep.
   void pBusyWake(THandle);
 
@@ -156,6 +195,22 @@ namespace plasma {
   // Returns lowest (highest value) priority.
   unsigned pLowestPriority();
 
+  // Set the current thread's deadline, an absolute time used by processors
+  // with the EDF scheduling policy.  As with pSetPriority, this performs a
+  // thread swap so that the deadline takes effect immediately.
+  void pSetDeadline(ptime_t);
+  // Set another thread's deadline, e.g. one just spawned.
+  void pSetDeadline(THandle,ptime_t);
+
+  // Return the current thread's deadline, or NoDeadline.
+  ptime_t pGetDeadline();
+
+  // Set a thread's weight for processors with the WFQ scheduling policy.
+  // The default is 1.  Busy threads share a processor in proportion to their
+  // weights.
+  void pSetWeight(unsigned);
+  void pSetWeight(THandle,unsigned);
+
   // Kill the current thread.
   void pTerminate();
 
@@ -165,15 +220,62 @@ namespace plasma {
   // Lock processor (prevent preemption).
   void pLock(void);
 
-  // Unlock processor.
+  // Unlock processor.  This is a preemption point.
   void pUnlock(void);        
 
+  // If polled preemption is enabled (ConfigParms::_pollpreempt) and the
+  // current timeslice has expired, switch to the next ready thread.  Call this
+  // in long-running loops which contain no other preemption points.
+  void pPreemptPoint();
+
   // Returns lock status.
   bool pIsLocked();
 
   // Delays the current thread for the time specified.
   void pDelay(ptime_t);
 
+  // Kernel timers:  A timer calls a function at a future simulation time.  The
+  // function is called from within the scheduler, so no thread is needed to
+  // wait for the time to arrive.  It returns a thread to be woken, or 0.  Since
+  // the cluster is locked when it's called, it must not block or call any of
+  // the thread routines above.  Timers are used by Timeout and the clocked
+  // channels.
+  typedef THandle (TimerFunc)(void *);
+
+  class Timer;
+
+  // Arm a timer so that it calls f(arg) after the specified delay.  A pending
+  // timer is first cancelled.  The cluster should be locked, e.g. this may be
+  // called from within a channel.
+  void pSetTimer(Timer &,ptime_t delay,TimerFunc *f,void *arg);
+
+  // Cancel a pending timer.  Does nothing if the timer is not pending.
+  void pCancelTimer(Timer &);
+
+  // The timer object itself.  The timer is linked into the scheduler's timer
+  // wheel while it's pending, so it must remain valid until it expires or is
+  // cancelled.  Copying a timer does not copy its pending state.
+  class Timer {
+  public:
+    Timer() : _next(0), _prev(0), _when(0), _func(0), _arg(0) {};
+    Timer(const Timer &) : _next(0), _prev(0), _when(0), _func(0), _arg(0) {};
+    ~Timer() { if (pending()) pCancelTimer(*this); };
+    Timer &operator=(const Timer &) { return *this; };
+
+    bool pending() const { return _prev; };
+    // Expiry time.  Only valid if the timer is pending.
+    ptime_t when() const { return _when; };
+
+  private:
+    friend class TimerWheel;
+
+    Timer     *_next;
+    Timer     *_prev;
+    ptime_t    _when;
+    TimerFunc *_func;
+    void      *_arg;
+  };
+
   // Consumes the specified amount of time.  Note:  This is only
   // valid if the system has been configured to allow for time consumption.
   // Second parameter is a timeslice amount- if <= 0, the default timeslice
@@ -188,6 +290,110 @@ namespace plasma {
   // Return the current simulation time.
   ptime_t pTime();
 
+  // Statistics about the scanning of thread stacks by the garbage collector.
+  struct StackScanStats {
+    unsigned long _collections; // Number of times the stacks were scanned.
+    unsigned long _stacks;      // Total number of thread stacks scanned.
+    unsigned long _bytes;       // Total number of stack bytes scanned.
+
+    StackScanStats() : _collections(0), _stacks(0), _bytes(0) {};
+  };
+
+  // Return stack scanning statistics.
+  StackScanStats pStackScanStats();
+
+  // Statistics about the scheduler as a whole.
+  struct SchedStats {
+    uint64   _switches;     // Context switches.
+    uint64   _spawns;       // Threads created.
+    uint64   _terminations; // Threads which finished or were killed.
+    uint64   _sleeps;       // Times a thread blocked, e.g. on a channel.
+    uint64   _wakes;        // Times a thread was woken.
+    uint64   _delays;       // Calls to pDelay.
+    unsigned _delayq;       // Delayed threads.
+    unsigned _delayqmax;    // Most delayed threads at once.
+    unsigned _busyq;        // Busy processors waiting for their time to end.
+    unsigned _busyqmax;     // Most busy processors at once.
+    unsigned _timers;       // Pending kernel timers.
+    unsigned _timersmax;    // Most pending kernel timers at once.
+
+    SchedStats() : _switches(0), _spawns(0), _terminations(0), _sleeps(0), _wakes(0),
+                   _delays(0), _delayq(0), _delayqmax(0), _busyq(0), _busyqmax(0),
+                   _timers(0), _timersmax(0) {};
+  };
+
+  // Statistics about a processor.  Times are in simulation time.
+  struct ProcStats {
+    uint64   _switches;     // Context switches to threads on this processor.
+    ptime_t  _busy;         // Time consumed by busy threads.
+    ptime_t  _idle;         // Time not consumed by busy threads.
+    ptime_t  _delay;        // Total time for which its threads were delayed.
+    unsigned _ready;        // Threads in the ready queue.
+    unsigned _readymax;     // Most threads in the ready queue at once.
+
+    ProcStats() : _switches(0), _busy(0), _idle(0), _delay(0), _ready(0), _readymax(0) {};
+  };
+
+  // Statistics about a thread.
+  struct ThreadStats {
+    uint64   _switches;     // Number of times the thread was switched to.
+    ptime_t  _busy;         // Time consumed by the thread with pBusy.
+
+    ThreadStats() : _switches(0), _busy(0) {};
+  };
+
+  // Return statistics for the scheduler, a processor or a thread.
+  SchedStats pStats();
+  ProcStats pStats(const Processor &);
+  ThreadStats pStats(THandle);
+
+  // Write the scheduler and stack scanning statistics, and those of every
+  // processor, unfinished thread and blocked channel, as a JSON object.
+  void pDumpStats(std::ostream &);
+
+  // Kinds of events recorded when tracing.
+  enum TraceKind { TraceBusy, TraceDelay, TraceSpawn, TraceTerminate,
+                   TraceWrite, TraceRead, TraceEnergy };
+
+  // Event tracing:  If ConfigParms::_tracefile is set, the kernel records busy
+  // periods, delays, spawns, terminations, channel accesses and energy samples
+  // in a ring buffer, which holds the most recent ConfigParms::_tracesize
+  // events.  Events are stored in binary form and are only formatted when the
+  // trace is written.
+  class Trace {
+  public:
+    static void init(const ConfigParms &);
+
+    static bool enabled() { return _enabled; };
+
+    // Record an event of the current thread.  obj identifies the object
+    // involved, e.g. a channel, and arg is a count or duration.
+    static void record(TraceKind k,const void *obj,uint64 arg);
+    // Record an event of the specified thread and processor.
+    static void record(TraceKind k,ptime_t t,Proc *p,Thread *th,const void *obj,uint64 arg);
+
+    // Write the buffered events as Chrome trace-event JSON, using the
+    // simulation time as microseconds.  Each processor is shown as a process
+    // and each thread as a thread of its processor.
+    static void write(std::ostream &);
+    // Write the trace to ConfigParms::_tracefile, if tracing.  Called at exit.
+    static void write_file();
+
+  private:
+    static bool _enabled;
+  };
+
+  // Record an event if tracing is enabled.
+  inline void pTrace(TraceKind k,const void *obj,uint64 arg = 0)
+  {
+    if (Trace::enabled()) {
+      Trace::record(k,obj,arg);
+    }
+  }
+
+  // Write the trace buffer as Chrome trace-event JSON.
+  void pWriteTrace(std::ostream &);
+
   // Terminate program with return code .
   void pExit(int code);
 
@@ -291,7 +497,60 @@ namespace plasma {
   typedef ValueCheckGen<bool>::type BoolCheck;
 
   inline BoolCheck make_boolcheck(bool value) { return make_valuecheck(value); };
-  
+
+  // Counts the outstanding children of a thread, so that the parent can wait
+  // for all of them with a single sleep, rather than waiting on each child in
+  // turn.  This is what par and pfor blocks use to join their threads.
+  class JoinCounter {
+  public:
+    JoinCounter() : _count(0), _waiter(0) {};
+    // Children hold a pointer to their counter, which lives on the parent's
+    // stack, so a parent which leaves the block early (e.g. via an
+    // exception) must still wait for them before the counter goes away.
+    ~JoinCounter() { if (_count) wait(); };
+    // Count a thread.  It's released when the thread finishes, whether it
+    // returns or is killed.  A thread may be counted by only one JoinCounter.
+    void add(THandle);
+    // Block until all counted threads have finished.
+    void wait();
+    // Called by the scheduler, with the cluster locked, when a counted thread
+    // finishes.  Returns the thread to be woken, or 0.
+    THandle release();
+
+  private:
+    unsigned _count;
+    THandle  _waiter;
+  };
+
+  // Used by pfor blocks with a grain modifier.  The argument structures of up
+  // to n iterations are gathered into a chunk, which is then executed in
+  // order by a single thread.  A chunk's thread is placed according to its
+  // first iteration.  The parameter isn't called grain, because that's a
+  // keyword in Plasma code which includes this header.
+  class PforChunks {
+  public:
+    PforChunks(int n);
+    // Add an iteration.  The args structure (size bytes) is copied.
+    void add(UserFunc *f,const void *args,unsigned size,int priority);
+    void add(Proc *p,UserFunc *f,const void *args,unsigned size,int priority);
+    // Start any partial chunk, then wait for all chunks to finish.
+    void wait();
+
+  private:
+    typedef std::vector<char,traceable_allocator<char> > Buffer;
+
+    void flush();
+
+    JoinCounter _join;
+    unsigned    _grain;
+    unsigned    _count;    // Iterations in the current chunk.
+    Proc       *_proc;
+    UserFunc   *_func;
+    unsigned    _size;
+    int         _priority;
+    Buffer      _buf;
+  };
+
   //////////////////////////////////////////////////////////////////////////////
   //
   // Implementation.
@@ -24,7 +24,12 @@ namespace plasma {
 
   // processor: define one of the following
   // RT_i386   ... Intel 386 and compatibles
+  // RT_x86_64 ... 64-bit x86 (System V ABI)
+#ifdef __x86_64__
+#define RT_x86_64
+#else
 #define RT_i386
+#endif
 
   // thread package: define one of the following
   // RT_QT     ... quick threads package
@@ -54,7 +59,7 @@ namespace plasma {
   // Atomic testAndSet operation
   // (sets the value of an integer to ONE and return its old value)
 
-#ifdef RT_i386
+#if defined(RT_i386) || defined(RT_x86_64)
   static inline int testAndSet(volatile int *mutex) 
   {
     int result;
@@ -14,7 +14,7 @@
 #define _PROC_H_
 
 #include "Interface.h"
-#include "ThreadQ.h"
+#include "SchedPolicy.h"
 
 namespace plasma {
 
@@ -36,6 +36,10 @@ namespace plasma {
     const char *name() const { return _name; };
     void setName(const char *n) { _name = n; };
 
+    // Replace the scheduling policy of this processor and its siblings.  There
+    // must be no ready threads.
+    void setPolicy(ConfigParms::SchedKind k);
+
     // Create a thread and add to the ready queue.
     THandle create(UserFunc *f,void *arg,int pr = -1);
     std::pair<THandle ,void *> create(UserFunc *f,int nbytes,void *args,int pr = -1);
@@ -45,7 +49,7 @@ namespace plasma {
     void add_ready(THandle t);
     // Add a thread to the busy queue.
     void add_busy(THandle t);
-    // Get next available thread, respecting priorities.
+    // Get next available thread, as chosen by the scheduling policy.
     THandle get_ready();    
     // Try to remove thread from ready queue (if it exists).
     THandle get_ready(THandle t);
@@ -64,15 +68,45 @@ namespace plasma {
     Thread *busythread() const { return _busythread; };
     void clearBusyThread();
 
+    // Timeslice of the current busy period, if it was coalesced from several
+    // timeslices because no other thread was ready, else 0.
+    ptime_t slice() const { return _slice; };
+    void setSlice(ptime_t s) { _slice = s; };
+
     // Number of threads in object.
-    unsigned size() const { return _ready->thread_size(); };
+    unsigned size() const { return _ready->size(); };
     // Returns true if queue is empty.
-    bool empty() const { return _ready->thread_empty(); };
+    bool empty() const { return _ready->empty(); };
+
+    // Scheduling decisions, made by the policy (see SchedPolicy).
+    bool preempts(const Thread *t,const Thread *cur) const { return _ready->preempts(t,cur); };
+    bool timesliced(const Thread *t) const { return _ready->timesliced(t); };
+    bool alone(const Thread *t,const Thread *ignore) const { return _ready->alone(t,ignore); };
+
+    // Returns a waiting processor which shares this processor's ready queue,
+    // or 0 if there is none.
+    Proc *idle_sibling() const;
 
     // Amount of busy time left (if applicable).
     // This is starttime + time.
     ptime_t endtime() const;
 
+    // Position of the processor in a calendar event queue (see EventQueue).
+    void *calgroup() const { return _calgroup; };
+    void setCalgroup(void *g) { _calgroup = g; };
+    unsigned calindex() const { return _calindex; };
+    void setCalindex(unsigned i) { _calindex = i; };
+
+    // Statistics (see pStats).  The idle time and ready-queue size are filled
+    // in by current_stats.
+    ProcStats &stats() { return _stats; };
+    ProcStats current_stats() const;
+
+    // All processors which have been created, most recent first.  Processors
+    // stay on this list, so that their statistics may be reported at exit.
+    static Proc *first() { return _allprocs; };
+    Proc *next_proc() const { return _nextproc; };
+
     // Printt the ready queue to the specified stream.
     void print_ready(std::ostream &o) const;
     // Prints to cout.
@@ -85,11 +119,19 @@ namespace plasma {
     void init_internal(const char *n);
 
     static unsigned _numpriorities; // Number of allowed priorities.
+    static ConfigParms::SchedKind _schedpolicy; // Default scheduling policy.
+    static Proc *_allprocs;         // List of all processors.
 
     const char *_name;           // Optional name- memory not managed.
-    QVect      *_ready;          // Ready threads, in priority order.
+    SchedPolicy *_ready;         // Ready threads, ordered by the policy.
     THandle     _busythread;     // Current busy thread, if any.
     State       _state;          // Current processor state.
+    Proc       *_sibling;        // Ring of processors sharing _ready.
+    ptime_t     _slice;          // Timeslice of a coalesced busy period.
+    Proc       *_nextproc;       // Next on the list of all processors.
+    void       *_calgroup;       // Calendar event queue group, if queued.
+    unsigned    _calindex;       // Index within _calgroup.
+    ProcStats   _stats;          // Statistics.
   };
 
 }
@@ -11,12 +11,18 @@
 #ifndef _PROCQ_H_
 #define _PROCQ_H_
 
+#include <vector>
+
+#include "gc/gc_allocator.h"
+
 #include "Queue.h"
 
 namespace plasma {
 
   class Proc;
 
+  typedef std::vector<Proc*,traceable_allocator<Proc*> > PVect;
+
   class ProcQ : private Queue
   {
   public:
@@ -26,7 +32,8 @@ namespace plasma {
     Proc *get() { return reinterpret_cast<Proc*>(Queue::get()); };
     // Get if it exists in queue.  Removes it.  Returns 0 if not in queue.
     Proc *get(Proc *t) { return reinterpret_cast<Proc*>(Queue::get(reinterpret_cast<QBase*>(t))); };
-    // Returns next non-empty processor, or 0 if none exist.
+    // Returns next non-empty processor, or 0 if none exist.  Empty processors
+    // ahead of it are removed and set to waiting.
     Proc *get_non_empty();
     // Removes item:  The item better be in the queue else you're screwed.
     void remove(Proc *t) { Queue::remove(reinterpret_cast<QBase*>(t)); };
@@ -14,10 +14,13 @@
 // 
 // Once instantiated, a thread calls request with an amount.  At a minimum, this
 // will be satisifed in amount*timeslice time units.  The thread's processor is
-// busy for this time, but is timesliced by the timeslice of the quantity.  If
-// there is more than one thread making a request, then the quantity class
-// iterates over the requesting threads, decrementing their remaining amounts in
-// a round-robin fashion.
+// busy for this time.  If there is more than one thread making a request, then
+// the quantity serves the requesting threads one unit at a time, in a
+// round-robin fashion.
+//
+// Rather than stepping through each unit, the quantity computes when the next
+// request will complete and sleeps until then, or until a new request
+// arrives.  The cost of a request is therefore independent of its amount.
 //
 
 #ifndef _QUANTITY_H_
@@ -39,22 +42,96 @@ namespace plasma {
     void request(int amount);
 
     friend void work(Quantity *);
+    friend THandle quantity_timeout(void *);
   private:
     typedef BusyChan<int> RetChan;
-    // Note:  List is garbage collected so that you can erase from
-    // the list and the iterator is still valid.
-    typedef std::list<std::pair<RetChan,int>,gc_allocator<std::pair<RetChan,int> > > Returns;
 
-    Returns::iterator register_request(int);
+    // An outstanding request.  Requests are allocated on the collected heap,
+    // rather than on the requester's stack, so that one whose thread is
+    // killed while it waits doesn't leave a dangling pointer behind.  It is
+    // dropped, without a reply, once it completes.
+    struct Req {
+      Req() : _thread(pCurThread()) {};
+
+      RetChan  _done;
+      THandle  _thread;
+    };
+
+    // Outstanding requests, held in a segment tree indexed by arrival number.
+    // Each leaf holds the pass in which its request completes, so the next
+    // request to complete is found, and a range of requests delayed, in
+    // O(log n).  Arrival numbers are compacted when the tree fills up.
+    class Reqs {
+    public:
+      Reqs() : _next(0) { resize(16); };
+
+      unsigned size() const { return _nodes[1]._count; };
+      bool empty() const { return !size(); };
+      // Arrival number following those of all current requests.
+      unsigned end() const { return _next; };
+      Req *operator[](unsigned a) const { return _reqs[a]; };
+
+      // Add a request which completes in the given pass and return its
+      // arrival number.  If the tree is compacted, cur is renumbered.
+      unsigned push(Req *r,ptime_t pass,unsigned &cur);
+      void erase(unsigned a) { set(1,0,_cap,a,0,Inf); };
+      // Delay the requests with arrival numbers in [b,e) by one pass.
+      void delay(unsigned b,unsigned e) { add(1,0,_cap,b,e); };
+      // Number of requests with arrival numbers in [b,e).
+      unsigned count(unsigned b,unsigned e) { return count(1,0,_cap,b,e); };
+      // Arrival number of the n'th request, counting from 1 in arrival order.
+      unsigned select(unsigned n);
+      // Next request to complete, i.e. the one with the lowest pass, the
+      // newest winning a tie.  Returns its arrival number and sets pass.
+      unsigned top(ptime_t &pass);
+
+    private:
+      static const ptime_t Inf = ~(ptime_t)0;
 
-    Channel<Returns::iterator> _request;
-    Returns _returns;
+      struct Node {
+        ptime_t  _min;     // Lowest pass in the subtree.
+        ptime_t  _add;     // Delay not yet applied to the children.
+        unsigned _count;   // Requests in the subtree.
+      };
+
+      typedef std::vector<Node> Nodes;
+      typedef std::vector<Req*,traceable_allocator<Req*> > Slots;
+
+      void resize(unsigned cap);
+      void apply(unsigned n,ptime_t d);
+      void push_down(unsigned n);
+      void pull_up(unsigned n);
+      void set(unsigned n,unsigned lo,unsigned hi,unsigned a,Req *r,ptime_t pass);
+      void add(unsigned n,unsigned lo,unsigned hi,unsigned b,unsigned e);
+      unsigned count(unsigned n,unsigned lo,unsigned hi,unsigned b,unsigned e);
+      void flatten(unsigned n,unsigned lo,unsigned hi,std::vector<ptime_t> &passes);
+
+      Nodes    _nodes;
+      Slots    _reqs;
+      unsigned _cap;
+      unsigned _next;
+    };
+
+    ptime_t next_unit(unsigned &a);
+    void advance(ptime_t now);
+    void serve(ptime_t units);
+    void wake_worker();
+
+    // Requests are served one unit at a time, in passes over the outstanding
+    // requests from the newest to the oldest.  Requests with arrival numbers
+    // of at least _cur have been served in the current pass.
+    Reqs            _reqs;
+    ptime_t         _pass;     // Current pass.
+    unsigned        _cur;      // Last request served.
+    ptime_t         _start;    // Start time of the unit in progress.
+    THandle         _worker;   // Worker thread, if it's sleeping.
+    Timer           _timer;    // Wakes the worker at the next completion.
 
     ptime_t _ts;
     Processor _p;
   };
 
-  inline Quantity::Quantity(int ts) : _ts(ts) 
+  inline Quantity::Quantity(int ts) : _pass(0), _cur(0), _start(0), _worker(0), _ts(ts) 
   { 
     // Can't use the spawn operator b/c of namespace issues.
     // Fix this when OpenC++ improves.
@@ -63,53 +140,270 @@ namespace plasma {
 
   inline void Quantity::request(int amount)
   {
-    Returns::iterator iter = register_request(amount);
-    _request.write(iter);
-    iter->first.get();
+    if (amount <= 0) {
+      return;
+    }
+    // A new request is the newest, so it counts as served in the current
+    // pass and is first served in the next one.
+    Req *r = new (GC) Req;
+    if (_reqs.empty()) {
+      _start = pTime();
+      _cur = _reqs.push(r,_pass + amount,_cur);
+    } else {
+      advance(pTime());
+      _reqs.push(r,_pass + amount,_cur);
+    }
+    wake_worker();
+    r->_done.get();
   }
 
-  inline Quantity::Returns::iterator Quantity::register_request(int amount)
+  // Returns the number of units, counted from _start, after which the next
+  // request completes, and sets a to its arrival number.
+  inline ptime_t Quantity::next_unit(unsigned &a)
   {
-    _returns.push_front(std::make_pair(RetChan(_ts),amount));
-    return _returns.begin();
+    ptime_t pass;
+    a = _reqs.top(pass);
+    if (pass == _pass) {
+      return _reqs.count(a,_cur);
+    }
+    return _reqs.count(0,_cur) + (pass - _pass - 1) * _reqs.size() + _reqs.count(a,_reqs.end());
   }
 
-  inline void work(Quantity *q)
+  // Apply the given number of units, none of which completes a request.
+  inline void Quantity::serve(ptime_t units)
   {
-    while (true) {
-      // Block if nothing to do.
-      Quantity::Returns::iterator iter = q->_request.get();
-      // Now we loop, slowly using up the required quantities.
-      while (true) {
-        pDelay(q->_ts);
-        // Find next item to service.
-        do {
-          ++iter;
-          if (iter == q->_returns.end()) {
-            iter = q->_returns.begin();
-          }
-        } while (!iter->second);
-        if (!(--iter->second)) {
-          // Done with this item:  Wake it up.
-          iter->first.write(0);
-          // Remove from list- the receiver's copy of
-          // the iterator is still valid b/c of gc.
-          q->_returns.erase(iter);
-          // If nothing in list, exit from this loop so that
-          // we'll sleep until something comes along.
-          if (q->_returns.empty()) {
-            break;
-          } else {
-            // Else- start at beginning b/c we can't increment the iterator.
-            iter = q->_returns.begin();
+    if (!units) {
+      return;
+    }
+    _start += units * _ts;
+    ptime_t left = _reqs.count(0,_cur);
+    if (units <= left) {
+      _cur = _reqs.select(left - units + 1);
+    } else {
+      ptime_t k = _reqs.size();
+      units -= left + 1;
+      _pass += 1 + units / k;
+      _cur = _reqs.select(k - units % k);
+    }
+  }
+
+  // Bring the requests up to date with the current time, waking any threads
+  // whose requests have completed.
+  inline void Quantity::advance(ptime_t now)
+  {
+    while (!_reqs.empty()) {
+      ptime_t units = (now - _start) / _ts;
+      unsigned a;
+      ptime_t u = next_unit(a);
+      if (u > units) {
+        serve(units);
+        return;
+      }
+      // Serve everything up to the completing unit, then remove the finished
+      // request.  Service then starts a new pass, after the newest request,
+      // so that request and those not yet served in this pass each lose a
+      // pass.
+      serve(u);
+      Req *r = _reqs[a];
+      _reqs.erase(a);
+      _reqs.delay(0,a);
+      if (!_reqs.empty()) {
+        _cur = _reqs.select(_reqs.size());
+        _reqs.delay(_cur,_cur + 1);
+        ++_pass;
+      }
+      if (!pDone(r->_thread)) {
+        r->_done.write(0);
+      }
+    }
+  }
+
+  inline unsigned Quantity::Reqs::push(Req *r,ptime_t pass,unsigned &cur)
+  {
+    if (_next == _cap) {
+      // Renumber the current requests from 0, in the same order.
+      std::vector<ptime_t> passes(_cap);
+      flatten(1,0,_cap,passes);
+      Slots reqs;
+      reqs.swap(_reqs);
+      unsigned n = size(), c = 0, cap = 16;
+      while (cap < 2 * (n + 1)) {
+        cap *= 2;
+      }
+      resize(cap);
+      for (unsigned a = 0; a != reqs.size(); ++a) {
+        if (reqs[a]) {
+          if (a < cur) {
+            ++c;
           }
+          set(1,0,_cap,_next++,reqs[a],passes[a]);
         }
-        // Check for any new requests.
-        alt {
-          q->_request.port() { ; }
-          { ; }
-        }
       }
+      cur = c;
+    }
+    set(1,0,_cap,_next,r,pass);
+    return _next++;
+  }
+
+  inline unsigned Quantity::Reqs::select(unsigned n)
+  {
+    unsigned i = 1, lo = 0, hi = _cap;
+    while (hi - lo > 1) {
+      unsigned mid = (lo + hi) / 2;
+      if (n <= _nodes[2*i]._count) {
+        i = 2*i;
+        hi = mid;
+      } else {
+        n -= _nodes[2*i]._count;
+        i = 2*i+1;
+        lo = mid;
+      }
+    }
+    return lo;
+  }
+
+  inline unsigned Quantity::Reqs::top(ptime_t &pass)
+  {
+    unsigned i = 1, lo = 0, hi = _cap;
+    while (hi - lo > 1) {
+      push_down(i);
+      unsigned mid = (lo + hi) / 2;
+      if (_nodes[2*i+1]._min <= _nodes[2*i]._min) {
+        i = 2*i+1;
+        lo = mid;
+      } else {
+        i = 2*i;
+        hi = mid;
+      }
+    }
+    pass = _nodes[i]._min;
+    return lo;
+  }
+
+  inline void Quantity::Reqs::resize(unsigned cap)
+  {
+    Node n = { Inf, 0, 0 };
+    _nodes.assign(2 * cap,n);
+    _reqs.assign(cap,0);
+    _cap = cap;
+    _next = 0;
+  }
+
+  inline void Quantity::Reqs::apply(unsigned n,ptime_t d)
+  {
+    if (_nodes[n]._count) {
+      _nodes[n]._min += d;
+    }
+    _nodes[n]._add += d;
+  }
+
+  inline void Quantity::Reqs::push_down(unsigned n)
+  {
+    if (ptime_t d = _nodes[n]._add) {
+      apply(2*n,d);
+      apply(2*n+1,d);
+      _nodes[n]._add = 0;
+    }
+  }
+
+  inline void Quantity::Reqs::pull_up(unsigned n)
+  {
+    const Node &l = _nodes[2*n], &r = _nodes[2*n+1];
+    _nodes[n]._min = std::min(l._min,r._min);
+    _nodes[n]._count = l._count + r._count;
+  }
+
+  inline void Quantity::Reqs::set(unsigned n,unsigned lo,unsigned hi,unsigned a,Req *r,ptime_t pass)
+  {
+    if (hi - lo == 1) {
+      _reqs[a] = r;
+      _nodes[n]._min = pass;
+      _nodes[n]._count = (r) ? 1 : 0;
+      return;
+    }
+    push_down(n);
+    unsigned mid = (lo + hi) / 2;
+    if (a < mid) {
+      set(2*n,lo,mid,a,r,pass);
+    } else {
+      set(2*n+1,mid,hi,a,r,pass);
+    }
+    pull_up(n);
+  }
+
+  inline void Quantity::Reqs::add(unsigned n,unsigned lo,unsigned hi,unsigned b,unsigned e)
+  {
+    if (e <= lo || hi <= b || !_nodes[n]._count) {
+      return;
+    }
+    if (b <= lo && hi <= e) {
+      apply(n,1);
+      return;
+    }
+    push_down(n);
+    unsigned mid = (lo + hi) / 2;
+    add(2*n,lo,mid,b,e);
+    add(2*n+1,mid,hi,b,e);
+    pull_up(n);
+  }
+
+  inline unsigned Quantity::Reqs::count(unsigned n,unsigned lo,unsigned hi,unsigned b,unsigned e)
+  {
+    if (e <= lo || hi <= b) {
+      return 0;
+    }
+    if (b <= lo && hi <= e) {
+      return _nodes[n]._count;
+    }
+    unsigned mid = (lo + hi) / 2;
+    return count(2*n,lo,mid,b,e) + count(2*n+1,mid,hi,b,e);
+  }
+
+  inline void Quantity::Reqs::flatten(unsigned n,unsigned lo,unsigned hi,std::vector<ptime_t> &passes)
+  {
+    if (!_nodes[n]._count) {
+      return;
+    }
+    if (hi - lo == 1) {
+      passes[lo] = _nodes[n]._min;
+      return;
+    }
+    push_down(n);
+    unsigned mid = (lo + hi) / 2;
+    flatten(2*n,lo,mid,passes);
+    flatten(2*n+1,mid,hi,passes);
+  }
+
+  inline void Quantity::wake_worker()
+  {
+    if (THandle w = _worker) {
+      _worker = 0;
+      pCancelTimer(_timer);
+      pWake(w);
+    }
+  }
+
+  inline THandle quantity_timeout(void *a)
+  {
+    Quantity *q = (Quantity *)a;
+    THandle w = q->_worker;
+    q->_worker = 0;
+    return w;
+  }
+
+  inline void work(Quantity *q)
+  {
+    while (true) {
+      q->advance(pTime());
+      // Sleep until the next request completes, or until a new request
+      // arrives.  With nothing to do, we just sleep.
+      if (!q->_reqs.empty()) {
+        unsigned a;
+        ptime_t t = q->_start + q->next_unit(a) * q->_ts;
+        pSetTimer(q->_timer,t - pTime(),quantity_timeout,q);
+      }
+      q->_worker = pCurThread();
+      pSleep();
     }
   }
   
@@ -0,0 +1,174 @@
+//
+// Copyright (C) 2005 by Freescale Semiconductor Inc.  All rights reserved.
+//
+// You may distribute under the terms of the Artistic License, as specified in
+// the COPYING file.
+//
+//
+// Ring buffer used as the default storage for queued channels.
+//
+
+#ifndef _RINGBUFFER_H_
+#define _RINGBUFFER_H_
+
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string.h>
+
+namespace plasma {
+
+  // A queue stored in a contiguous, circular array.  It supports the subset of
+  // the std::list interface used by the queued channels:  Elements are added
+  // with push_front and removed with pop_back, so back() is the oldest
+  // element.  The capacity is a power of two and doubles when the buffer is
+  // full, so once a channel has reached its working size, no more allocation
+  // is done.  Use reserve() to size the buffer up front, e.g. for a channel
+  // with a maximum size.  Sizes beyond max_size(), including a push onto a
+  // buffer which already holds max_size() elements, are rejected with
+  // std::length_error.
+  template <typename T,typename Alloc = std::allocator<T> >
+  class RingBuffer {
+  public:
+    typedef T        value_type;
+    typedef T       &reference;
+    typedef const T &const_reference;
+    typedef unsigned size_type;
+
+    RingBuffer() : _data(0), _mask(0), _tail(0), _size(0) {};
+    RingBuffer(const RingBuffer &x) : _data(0), _mask(0), _tail(0), _size(0) { copy(x); };
+    ~RingBuffer() { clear(); release(); };
+
+    RingBuffer &operator=(const RingBuffer &x)
+    {
+      if (this != &x) {
+        clear();
+        copy(x);
+      }
+      return *this;
+    }
+
+    bool empty() const { return _size == 0; };
+    size_type size() const { return _size; };
+    size_type capacity() const { return (_data) ? _mask+1 : 0; };
+    static size_type max_size() { return MaxCapacity; };
+
+    // Newest element.
+    reference front() { return _data[(_tail + _size - 1) & _mask]; };
+    const_reference front() const { return _data[(_tail + _size - 1) & _mask]; };
+
+    // Oldest element.
+    reference back() { return _data[_tail]; };
+    const_reference back() const { return _data[_tail]; };
+
+    void push_front(const T &x)
+    {
+      if (_size == capacity()) {
+        if (_size == MaxCapacity) {
+          throw std::length_error("RingBuffer is full.");
+        }
+        reserve((_size) ? 2*_size : MinCapacity);
+      }
+      new (&_data[(_tail + _size) & _mask]) T(x);
+      ++_size;
+    }
+
+    void pop_back()
+    {
+      erase(_tail);
+      _tail = (_tail + 1) & _mask;
+      --_size;
+    }
+
+    void clear()
+    {
+      while (!empty()) {
+        pop_back();
+      }
+      _tail = 0;
+    }
+
+    // Make room for at least n elements.
+    void reserve(size_type n)
+    {
+      if (n <= capacity()) {
+        return;
+      }
+      if (n > MaxCapacity) {
+        throw std::length_error("RingBuffer capacity too large.");
+      }
+      size_type c = MinCapacity;
+      while (c < n) {
+        c *= 2;
+      }
+      T *d = _alloc.allocate(c);
+      for (size_type i = 0; i != _size; ++i) {
+        size_type j = (_tail + i) & _mask;
+        new (&d[i]) T(_data[j]);
+        erase(j);
+      }
+      release();
+      _data = d;
+      _mask = c - 1;
+      _tail = 0;
+    }
+
+  private:
+    enum { MinCapacity = 8 };
+    // Largest power of two which fits in size_type.
+    static const size_type MaxCapacity = ~(~(size_type)0 >> 1);
+
+    // Destroy an element.  The slot is zeroed so that the collector does not
+    // see stale pointers in it.
+    void erase(size_type i)
+    {
+      _data[i].~T();
+      memset((void*)&_data[i],0,sizeof(T));
+    }
+
+    void release()
+    {
+      if (_data) {
+        _alloc.deallocate(_data,_mask+1);
+        _data = 0;
+        _mask = 0;
+      }
+    }
+
+    void copy(const RingBuffer &x)
+    {
+      reserve(x._size);
+      for (size_type i = 0; i != x._size; ++i) {
+        push_front(x._data[(x._tail + i) & x._mask]);
+      }
+    }
+
+    Alloc     _alloc;
+    T        *_data;
+    size_type _mask;     // Capacity - 1.
+    size_type _tail;     // Index of the oldest element.
+    size_type _size;
+  };
+
+  // Size a channel's store for n elements, if the container supports it.  A
+  // negative channel size is an error.
+  template <typename C>
+  inline void reserve_store(C &,int n)
+  {
+    if (n < 0) {
+      throw std::length_error("Negative channel size.");
+    }
+  }
+
+  template <typename T,typename A>
+  inline void reserve_store(RingBuffer<T,A> &s,int n)
+  {
+    if (n < 0) {
+      throw std::length_error("Negative channel size.");
+    }
+    s.reserve(n);
+  }
+
+}
+
+#endif
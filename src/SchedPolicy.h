@@ -0,0 +1,174 @@
+//
+// Copyright (C) 2005 by Freescale Semiconductor Inc.  All rights reserved.
+//
+// You may distribute under the terms of the Artistic License, as specified in
+// the COPYING file.
+//
+//
+// Scheduling policies.  A processor delegates the ordering of its ready
+// threads to a policy object, which also decides whether a thread becoming
+// ready interrupts a busy thread and whether busy time is timesliced.  The
+// policy is selected per processor (see Processor::setPolicy), with the default
+// set by ConfigParms::_schedpolicy.  Processors which share a ready queue share
+// its policy.
+//
+// New policies are added by deriving from SchedPolicy and adding a kind to
+// ConfigParms::SchedKind, which SchedPolicy::create maps to the class.
+//
+
+#ifndef _SCHEDPOLICY_H_
+#define _SCHEDPOLICY_H_
+
+#include <iosfwd>
+#include <vector>
+
+#include "Interface.h"
+#include "ThreadQ.h"
+
+namespace plasma {
+
+  class SchedPolicy {
+  public:
+    virtual ~SchedPolicy() {};
+
+    // Create a policy of the given kind.
+    static SchedPolicy *create(ConfigParms::SchedKind k,unsigned numpriorities);
+
+    // Add a thread which has become ready.
+    virtual void add(Thread *t) = 0;
+    // Remove and return the next thread to run.  Returns 0 if there are none.
+    virtual Thread *get() = 0;
+    // Remove the specified thread.  Returns 0 if it is not in the queue.
+    virtual Thread *get(Thread *t) = 0;
+    // Remove a thread known to be in the queue.
+    virtual void remove(Thread *t) = 0;
+    // Next thread to run- does not remove it.
+    virtual Thread *front() const = 0;
+    // Number of ready threads.
+    virtual unsigned size() const = 0;
+    bool empty() const { return !size(); };
+
+    // Returns true if t, on becoming ready, interrupts the busy thread cur.
+    virtual bool preempts(const Thread *t,const Thread *cur) const = 0;
+    // Returns true if busy time consumed by t is divided into timeslices.
+    virtual bool timesliced(const Thread *t) const = 0;
+    // Returns true if no ready thread other than ignore would take a timeslice
+    // from t, so that t may request all of its busy time at once.  The
+    // timeslices are then imposed later by Cluster::split_busy, which assumes
+    // that only a thread of t's priority competes for them.
+    virtual bool alone(const Thread *,const Thread *) const { return false; };
+    // The busy thread t has given up the processor after consuming the
+    // specified amount of time.
+    virtual void charge(Thread *,ptime_t) {};
+
+    virtual void print(std::ostream &) const = 0;
+  };
+
+  // Strict fixed priority:  The highest-priority ready thread runs first and
+  // threads of equal priority run in FIFO order.  A higher-priority thread
+  // interrupts a busy thread and only the lowest priority is timesliced.
+  class PriorityPolicy : public SchedPolicy {
+  public:
+    PriorityPolicy(unsigned np) : _ready(np) {};
+
+    virtual void add(Thread *t);
+    virtual Thread *get() { return _ready.get(); };
+    virtual Thread *get(Thread *t);
+    virtual void remove(Thread *t);
+    virtual Thread *front() const { return _ready.front(); };
+    virtual unsigned size() const { return _ready.thread_size(); };
+
+    virtual bool preempts(const Thread *t,const Thread *cur) const;
+    virtual bool timesliced(const Thread *t) const;
+    virtual bool alone(const Thread *t,const Thread *ignore) const;
+
+    virtual void print(std::ostream &) const;
+
+  private:
+    QVect _ready;
+  };
+
+  // Base for policies which keep the ready threads in a binary heap, ordered by
+  // a key computed when a thread is added.  Lower keys run first and threads
+  // with equal keys run in the order in which they were added.  Each thread
+  // records its position in the heap, so that any thread may be removed in
+  // O(log n).
+  class HeapPolicy : public SchedPolicy {
+  public:
+    HeapPolicy() : _seq(0) {};
+
+    virtual void add(Thread *t);
+    virtual Thread *get();
+    virtual Thread *get(Thread *t);
+    virtual void remove(Thread *t);
+    virtual Thread *front() const;
+    virtual unsigned size() const { return _heap.size(); };
+
+    virtual void print(std::ostream &) const;
+
+  protected:
+    // The key under which a thread is added.
+    virtual uint64 key(Thread *t) = 0;
+    // Key of the next thread to run.  The heap must not be empty.
+    uint64 front_key() const { return _heap.front()._key; };
+
+  private:
+    struct Entry {
+      uint64  _key;
+      uint64  _seq;
+      Thread *_thread;
+    };
+    typedef std::vector<Entry,traceable_allocator<Entry> > Heap;
+
+    static bool before(const Entry &x,const Entry &y);
+    void place(unsigned i,const Entry &e);
+    void up(unsigned i,Entry e);
+    void down(unsigned i,Entry e);
+    void erase(unsigned i);
+
+    Heap   _heap;
+    uint64 _seq;
+  };
+
+  // Earliest deadline first:  The ready thread with the earliest deadline
+  // (see pSetDeadline) runs first; threads without a deadline run after all
+  // threads with one.  A thread with an earlier deadline interrupts a busy
+  // thread.  Busy time is not timesliced.  Thread priorities are ignored.
+  class EdfPolicy : public HeapPolicy {
+  public:
+    virtual bool preempts(const Thread *t,const Thread *cur) const;
+    virtual bool timesliced(const Thread *) const { return false; };
+
+  protected:
+    virtual uint64 key(Thread *t);
+  };
+
+  // Weighted fair queueing, using start-time fair queueing:  Each thread has a
+  // virtual time which advances by the busy time it consumes divided by its
+  // weight (see pSetWeight).  The ready thread with the lowest virtual time
+  // runs first.  A thread which becomes ready is brought forward to the
+  // virtual time of the last thread dispatched, so that idle threads don't
+  // accumulate credit.  All busy time is timesliced, so that busy threads share
+  // the processor in proportion to their weights, and no thread interrupts a
+  // busy thread.  Thread priorities are ignored.
+  class WfqPolicy : public HeapPolicy {
+  public:
+    WfqPolicy() : _vtime(0) {};
+
+    virtual Thread *get();
+    using HeapPolicy::get;
+
+    virtual bool preempts(const Thread *,const Thread *) const { return false; };
+    virtual bool timesliced(const Thread *) const { return true; };
+    virtual void charge(Thread *t,ptime_t used);
+
+  protected:
+    virtual uint64 key(Thread *t);
+
+  private:
+    uint64 _vtime;     // Virtual time of the last thread dispatched.
+  };
+
+}
+
+#endif
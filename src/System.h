@@ -11,10 +11,12 @@
 #define _SYSTEM_H_
 
 #include <iosfwd>
-#include <queue>
 
 #include "Interface.h"
 #include "ThreadQ.h"
+#include "ProcQ.h"
+#include "EventQueue.h"
+#include "TimerWheel.h"
 
 // Rule of thumb minimum to keep the gc happy.
 const int StackMin = 0x8000;
@@ -25,18 +27,20 @@ namespace plasma {
 
   int dummy();
 
-  // Returns true if x's time is greater than y's time.
-  template <class T1,class T2>
-  struct greater_time {
-    bool operator()(const T1 *x,const T2 *y);
-  };
+  // Write a string as a JSON value.  A null string is written as null.
+  void json_string(std::ostream &o,const char *str);
 
-  // Sorts Threads by descending time- the smallest time value will be first.
-  typedef std::priority_queue<Thread*,std::vector<THandle,traceable_allocator<THandle> >,greater_time<Thread,Thread> > TPriQueue;
-  struct PPriQueue : public std::priority_queue<Proc*,std::vector<Proc*,traceable_allocator<Proc*> >,greater_time<Proc,Proc> >
+  // Raise a high-water mark to n.
+  inline void set_max(unsigned &m,unsigned n)
   {
-    void print() const;
-  };
+    if (n > m) {
+      m = n;
+    }
+  }
+
+  // Sorts by ascending end-time- the smallest time value will be first.
+  typedef EventQueue<Thread> TPriQueue;
+  typedef EventQueue<Proc>   PPriQueue;
 
   class System                    
   {
@@ -48,6 +52,16 @@ namespace plasma {
     void *newstack();                  // return appropriate thread stack
     void dispose(void *stack);         // dispose stack for later reuse
 
+    // Statistics about stack scanning by the collector.
+    const StackScanStats &scanstats() const { return _scanstats; };
+
+    // Scheduler statistics.  The queue sizes are filled in by queue_stats.
+    SchedStats &stats() { return _stats; };
+    void queue_stats(SchedStats &) const;
+    // Write the statistics to the file given by ConfigParms::_statsfile, if
+    // any.  Called at exit.
+    void write_stats() const;
+
     void shutdown(int code);           // trigger program shutdown 
   
     int retcode() const;
@@ -59,8 +73,8 @@ namespace plasma {
     // Current time.
     ptime_t time() const { return _time; };
 
-    // This updates time to the next time value, which is the lesser of
-    // the top of _busy or _delay.  Returns false if nothing else is
+    // This updates time to the next time value, which is the least of
+    // the top of _busy, _delay or _timers.  Returns false if nothing else is
     // available, or true if there is something available.
     bool update_time();
 
@@ -71,25 +85,62 @@ namespace plasma {
     // Add a delayed thread.  The time specifies for how long to delay.
     void add_delay(ptime_t t,Thread *th);
 
-    // Returns the next thread with the same time as the current time.
-    // Returns 0 if no elements remain (at the current time).
-    Thread *get_delay();
+    // Removes all threads whose delay ends at the current time and appends
+    // them to v, in queue order.
+    void get_delay(TVect &v);
 
-    // Returns the next processor with the same time as the current time.
-    // Returns 0 if no elements remain (at the current time).
-    Proc *get_busy();
+    // Removes all processors whose busy period ends at the current time and
+    // appends them to v, in queue order.  Each processor's busy thread is
+    // returned to its ready queue.
+    void get_busy(PVect &v);
+
+    // A busy processor's end-time has been moved earlier, e.g. because its
+    // busy thread was interrupted by a higher priority thread.
+    void reschedule_busy(Proc *p);
+
+    // Arm a kernel timer to expire after the specified delay.
+    void add_timer(Timer *x,ptime_t t,TimerFunc *f,void *arg)
+    {
+      _timers.add(x,_time+t,f,arg);
+      PLASMA_STAT(set_max(_stats._timersmax,_timers.size()));
+    };
+
+    // Cancel a pending kernel timer.
+    void cancel_timer(Timer *x) { _timers.remove(x); };
+
+    // Expires all timers which are due at the current time and appends the
+    // threads which they wake to v.
+    void get_timers(TVect &v) { _timers.expire(v); };
 
     // Add or remove threads from active list.
     static void add_active_thread(Thread *);
     static void remove_active_thread(Thread *);
     static unsigned num_active_threads();
+    // Most recently added active thread.  The rest follow via Thread::nt().
+    static Thread *active_threads() { return _active_list; };
 
   private:
-    template <class C,class T> T *get_current(C &q);
+    template <class C,class V,class F> void get_current(C &q,V &v,F f);
 
     static void push_other_roots();
 
+    void *allocstack();
+    void freestack(void *);
+    void trimstack(void *);
+
+    typedef std::vector<void *,traceable_allocator<void *> > Stacks;
+
     int     _size;             // Default stack size of threads
+    Stacks  _stackpool;        // Idle stacks, most recently freed last.
+    unsigned _stackmax;        // Max number of idle stacks to keep.
+    unsigned _trimmed;         // Stacks below this index in _stackpool are trimmed.
+    unsigned _lowwater;        // Smallest pool size in the current trim period.
+    unsigned _disposals;       // Disposals in the current trim period.
+    bool    _stackguard;       // Stacks are mmap'd with a guard page.
+    unsigned _pagesize;        // System page size, for guarded stacks.
+    StackScanStats _scanstats; // Stack scanning statistics.
+    const char *_statsfile;    // Where to write statistics at exit.
+    SchedStats _stats;         // Scheduler statistics.
     int     _code;             // Exit code.
     bool    _wantshutdown;     // Flag indicates that a shutdown is desired.
     bool    _busyokay;         // Is time consumption legal?
@@ -99,6 +150,7 @@ namespace plasma {
     ptime_t   _time;           // Current time of the system.
     TPriQueue _delay;          // Delayed threads.
     PPriQueue _busy;           // Busy processors.
+    TimerWheel _timers;        // Pending kernel timers.
   };
 
   inline int System::stacksize() const 
@@ -18,6 +18,8 @@ typedef struct qt_t qt_t;
 
 namespace plasma {
 
+  struct WaitNode;
+
   class Thread : public QBase
   {
   public:
@@ -26,12 +28,19 @@ namespace plasma {
 
     // Allocate a stack for this thread.  The thread will execute f(arg).
     void realize(UserFunc *f,void *arg);
+
+    // Unique id, assigned in order of creation.  Unlike the address of a
+    // thread, it is not reused after the thread is collected.
+    unsigned id() const { return _id; };
  
     // Destroy real thread i.e. deallocate its stack
     void destroy(void);
 
     // Saves stack pointer.
     void save(qt_t *sptr);
+    // Location of the saved stack pointer, for switch primitives which store
+    // it directly.
+    qt_t **savearea() { return &_thread; };
 
     qt_t *thread() { return _thread; };
 
@@ -71,6 +80,24 @@ namespace plasma {
     unsigned priority() const { return _priority; };
     void setPriority(unsigned p) { _priority = p; };
 
+    // Attributes used by the deadline and fair-queueing scheduling policies.
+    ptime_t deadline() const { return _deadline; };
+    void setDeadline(ptime_t d) { _deadline = d; };
+    unsigned weight() const { return _weight; };
+    void setWeight(unsigned w) { _weight = w; };
+    uint64 vtime() const { return _vtime; };
+    void setVtime(uint64 v) { _vtime = v; };
+
+    // Position of the thread in a heap-based ready queue.
+    unsigned slot() const { return _slot; };
+    void setSlot(unsigned s) { _slot = s; };
+
+    // Position of the thread in a calendar event queue (see EventQueue).
+    void *calgroup() const { return _calgroup; };
+    void setCalgroup(void *g) { _calgroup = g; };
+    unsigned calindex() const { return _calindex; };
+    void setCalindex(unsigned i) { _calindex = i; };
+
     ptime_t time() const { return _time; };
     ptime_t starttime() const { return _starttime; };
     ptime_t endtime() const { return _starttime + _time; };
@@ -85,6 +112,19 @@ namespace plasma {
     void setnt(Thread *n) { _nt = n; };
     void setpt(Thread *p) { _pt = p; };
 
+    // Channel registrations of this thread (see WaitList).
+    WaitNode *waits() const { return _waits; };
+    void setWaits(WaitNode *n) { _waits = n; };
+    unsigned numWaits() const { return _numwaits; };
+    void setNumWaits(unsigned n) { _numwaits = n; };
+
+    // Join counter to be released when this thread finishes.
+    JoinCounter *join() const { return _join; };
+    void setJoin(JoinCounter *j) { _join = j; };
+
+    // Statistics (see pStats).
+    ThreadStats &stats() { return _stats; };
+
 #   ifdef GC_DISABLED
     static void *operator new(size_t sz) { return ::operator new(sz); };
     static void *operator new(size_t sz,void *p) { return ::operator new(sz,p); };
@@ -97,6 +137,9 @@ namespace plasma {
 
     typedef std::vector<THandle,gc_allocator<THandle> > Waiters;
 
+    static unsigned _nextid;       // Id of the last thread created.
+
+    unsigned    _id;               // Unique id.
     State       _state;            // Current thread state.
     bool        _valid;            // Extra flag usable for state.
     Waiters     _waiters;          // Threads waiting on this thread.
@@ -105,13 +148,24 @@ namespace plasma {
     void       *_stackend;         // End of stack pointer.
     Proc       *_proc;             // Parent processor.
     unsigned    _priority;         // Current thread priority.
+    ptime_t     _deadline;         // Deadline, for EDF scheduling.
+    unsigned    _weight;           // Weight, for fair-queueing scheduling.
+    unsigned    _slot;             // Position in a heap-based ready queue.
+    uint64      _vtime;            // Virtual time, for fair-queueing scheduling.
+    void       *_calgroup;         // Calendar event queue group, if queued.
+    unsigned    _calindex;         // Index within _calgroup.
     ptime_t     _time;             // Busy or delay time of the thread.
     ptime_t     _starttime;        // Start time of a busy or delay.
     Thread     *_pt,*_nt;          // Linked-list pointers for active threads.
+    WaitNode   *_waits;            // Multi-consumer channel registrations.
+    unsigned    _numwaits;         // Number of registrations.
+    JoinCounter *_join;            // Parent's join counter, if any.
+    ThreadStats _stats;            // Statistics.
     char        _extraspace[];     // Allows for extra space to be allocated at end.
   };
 
   inline Thread::Thread() :
+    _id(++_nextid),
     _state(Run),
     _valid(true),
     _thread(0),
@@ -119,10 +173,19 @@ namespace plasma {
     _stackend(0),
     _proc(0),
     _priority(0),
+    _deadline(NoDeadline),
+    _weight(1),
+    _slot(0),
+    _vtime(0),
+    _calgroup(0),
+    _calindex(0),
     _time(0),
     _starttime(0),
     _pt(0),
-    _nt(0)
+    _nt(0),
+    _waits(0),
+    _numwaits(0),
+    _join(0)
   {
   }
 
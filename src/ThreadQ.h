@@ -43,17 +43,114 @@ namespace plasma {
     friend std::ostream &operator<<(std::ostream &,const ThreadQ &);
   };
 
+  // Index of the most-significant set bit of a non-zero word.
+  inline unsigned highest_bit(unsigned long long x)
+  {
+#   ifdef __GNUC__
+    return 63 - __builtin_clzll(x);
+#   else
+    unsigned i = 0;
+    while (x >>= 1) {
+      ++i;
+    }
+    return i;
+#   endif
+  }
+
+  // The ready queues of a processor, one per priority, where the highest
+  // index is the highest priority.  An occupancy bitmap is kept so that the
+  // highest non-empty queue is found with two count-leading-zero operations,
+  // regardless of the number of priorities:  Bit i of _summary is set if
+  // _bits[i] is non-zero and bit j of _bits[i] is set if queue i*64+j is
+  // non-empty.
   struct QVect : public std::vector<ThreadQ,traceable_allocator<ThreadQ> > {
+    typedef unsigned long long Word;
+    enum { WordBits = 64, MaxPriorities = WordBits*WordBits };
+
     QVect(unsigned np) : 
       std::vector<ThreadQ,traceable_allocator<ThreadQ> >(np),
+      _bits((np+WordBits-1)/WordBits,0),
+      _summary(0),
       _count(0)
     {};
 
     bool thread_empty() const { return _count == 0; };
     unsigned thread_size() const { return _count; };
 
-    // This should be made private at some point.
-    int _count;
+    // Highest non-empty priority, or -1 if there are no threads.
+    int top() const
+    {
+      if (!_summary) {
+        return -1;
+      }
+      unsigned w = highest_bit(_summary);
+      return w*WordBits + highest_bit(_bits[w]);
+    }
+
+    // Add to the back of the queue for priority p.
+    void add(Thread *t,unsigned p)
+    {
+      (*this)[p].add(t);
+      _bits[p/WordBits] |= (Word)1 << (p%WordBits);
+      _summary |= (Word)1 << (p/WordBits);
+      ++_count;
+    }
+
+    // Remove and return the first thread of the highest priority.
+    // Returns 0 if there are no threads.
+    Thread *get()
+    {
+      int p = top();
+      if (p < 0) {
+        return 0;
+      }
+      Thread *t = (*this)[p].get();
+      removed(p);
+      return t;
+    }
+
+    // Get the specified thread from the queue for priority p.  Returns 0 if
+    // it is not in that queue.
+    Thread *get(Thread *t,unsigned p)
+    {
+      if (Thread *next = (*this)[p].get(t)) {
+        removed(p);
+        return next;
+      }
+      return 0;
+    }
+
+    // Remove a thread known to be in the queue for priority p.
+    void remove(Thread *t,unsigned p)
+    {
+      (*this)[p].remove(t);
+      removed(p);
+    }
+
+    // First thread of the highest priority- does not remove it.
+    Thread *front() const
+    {
+      int p = top();
+      return (p < 0) ? 0 : (*this)[p].front();
+    }
+
+  private:
+    // Update the count and bitmap after removing a thread from queue p.
+    void removed(unsigned p)
+    {
+      --_count;
+      if ((*this)[p].empty()) {
+        unsigned w = p/WordBits;
+        _bits[w] &= ~((Word)1 << (p%WordBits));
+        if (!_bits[w]) {
+          _summary &= ~((Word)1 << w);
+        }
+      }
+    }
+
+    std::vector<Word> _bits;
+    Word              _summary;
+    int               _count;
   };
 
   inline std::ostream &operator<<(std::ostream &o,const ThreadQ &tq)
@@ -0,0 +1,264 @@
+//
+// Copyright (C) 2005 by Freescale Semiconductor Inc.  All rights reserved.
+//
+// You may distribute under the terms of the Artistic License, as specified in
+// the COPYING file.
+//
+//
+// Hierarchical timer wheel used by the System object to store pending kernel
+// timers (see pSetTimer).
+//
+// Times are split into 6-bit digits.  Level l of the wheel holds the timers
+// whose expiry time first differs from the current time at digit l, in the
+// slot given by that digit.  A timer therefore stays in the same slot until
+// time advances to a point which matches the slot, at which point the slot is
+// redistributed into the lower levels.  Level 0 slots hold timers for a single
+// time value.  Each slot is a circular, doubly-linked list of timers, so
+// insertion and cancellation are O(1).  A bitmap per level records which
+// slots are occupied, so that the earliest timer can be found quickly.
+//
+// Time must only advance to a time which is not later than the earliest
+// timer.  The System object guarantees this, since it always advances to the
+// earliest event of any kind.  In the time model, time may occasionally move
+// backwards, when a busy processor is interrupted; in that case, the wheel is
+// rebuilt.
+//
+
+#ifndef _TIMERWHEEL_H_
+#define _TIMERWHEEL_H_
+
+#include "Interface.h"
+#include "ThreadQ.h"
+
+namespace plasma {
+
+  class TimerWheel {
+  public:
+    TimerWheel();
+    ~TimerWheel();
+
+    bool empty() const { return !_size; };
+    unsigned size() const { return _size; };
+
+    // Add a timer which expires at time t.  t must not be earlier than the
+    // current time.
+    void add(Timer *x,ptime_t t,TimerFunc *f,void *arg);
+    // Remove a pending timer.
+    void remove(Timer *x);
+    // Expiry time of the earliest timer.  The wheel must not be empty.
+    ptime_t top_time() const;
+    // Set the current time to t, which must not be later than the earliest
+    // timer.
+    void advance(ptime_t t);
+    // Remove all timers which expire at the current time, in the order in
+    // which they were added, calling each one's function.  Threads returned
+    // by the functions are appended to v.  Timers which the functions arm
+    // for the current time are left for the next call.
+    void expire(TVect &v);
+
+  private:
+    typedef unsigned long long Word;
+
+    enum { SlotBits = 6, Slots = 1 << SlotBits, Levels = (64 + SlotBits - 1) / SlotBits };
+
+    unsigned level(ptime_t t) const { return (t == _now) ? 0 : highest_bit(t ^ _now) / SlotBits; };
+    static unsigned digit(ptime_t t,unsigned l) { return (t >> (l*SlotBits)) & (Slots-1); };
+    static unsigned lowest_bit(Word x) { return highest_bit(x & -x); };
+
+    void link(Timer *x);
+    void unlink(Timer *x);
+    void rebuild(ptime_t t);
+
+    ptime_t   _now;                 // Current time.
+    unsigned  _size;                // Number of pending timers.
+    unsigned  _levels;              // Bitmap of non-empty levels.
+    Word      _occupied[Levels];    // Bitmap of non-empty slots, per level.
+    Timer     _slots[Levels][Slots];// List heads.
+  };
+
+  inline TimerWheel::TimerWheel() :
+    _now(0),
+    _size(0),
+    _levels(0)
+  {
+    for (unsigned l = 0; l != Levels; ++l) {
+      _occupied[l] = 0;
+      for (unsigned s = 0; s != Slots; ++s) {
+        _slots[l][s]._next = _slots[l][s]._prev = &_slots[l][s];
+      }
+    }
+  }
+
+  // The list heads are not real timers, so they must not try to cancel
+  // themselves.
+  inline TimerWheel::~TimerWheel()
+  {
+    for (unsigned l = 0; l != Levels; ++l) {
+      for (unsigned s = 0; s != Slots; ++s) {
+        _slots[l][s]._next = _slots[l][s]._prev = 0;
+      }
+    }
+  }
+
+  // Append the timer to the slot for its expiry time.
+  inline void TimerWheel::link(Timer *x)
+  {
+    unsigned l = level(x->_when);
+    unsigned s = digit(x->_when,l);
+    Timer *h = &_slots[l][s];
+    x->_next = h;
+    x->_prev = h->_prev;
+    h->_prev->_next = x;
+    h->_prev = x;
+    _occupied[l] |= (Word)1 << s;
+    _levels |= 1 << l;
+  }
+
+  inline void TimerWheel::unlink(Timer *x)
+  {
+    x->_prev->_next = x->_next;
+    x->_next->_prev = x->_prev;
+    x->_next = x->_prev = 0;
+    unsigned l = level(x->_when);
+    unsigned s = digit(x->_when,l);
+    Timer *h = &_slots[l][s];
+    if (h->_next == h) {
+      _occupied[l] &= ~((Word)1 << s);
+      if (!_occupied[l]) {
+        _levels &= ~(1 << l);
+      }
+    }
+  }
+
+  inline void TimerWheel::add(Timer *x,ptime_t t,TimerFunc *f,void *arg)
+  {
+    assert(t >= _now && !x->pending());
+    x->_when = t;
+    x->_func = f;
+    x->_arg = arg;
+    link(x);
+    ++_size;
+  }
+
+  inline void TimerWheel::remove(Timer *x)
+  {
+    assert(x->pending());
+    unlink(x);
+    --_size;
+  }
+
+  // All timers at the lowest non-empty level agree with the current time above
+  // that level, so the earliest timer is in the lowest occupied slot.  A level
+  // 0 slot represents a single time; otherwise we search the slot.
+  inline ptime_t TimerWheel::top_time() const
+  {
+    assert(!empty());
+    unsigned l = lowest_bit(_levels);
+    unsigned s = lowest_bit(_occupied[l]);
+    if (!l) {
+      return (_now & ~(ptime_t)(Slots-1)) | s;
+    }
+    const Timer *h = &_slots[l][s];
+    ptime_t t = h->_next->_when;
+    for (const Timer *x = h->_next->_next; x != h; x = x->_next) {
+      if (x->_when < t) {
+        t = x->_when;
+      }
+    }
+    return t;
+  }
+
+  // Re-link every timer relative to a new current time.
+  inline void TimerWheel::rebuild(ptime_t t)
+  {
+    Timer *all = 0;
+    for (unsigned l = 0; l != Levels; ++l) {
+      for (unsigned s = 0; s != Slots; ++s) {
+        Timer *h = &_slots[l][s];
+        while (h->_next != h) {
+          Timer *x = h->_next;
+          h->_next = x->_next;
+          x->_next = all;
+          all = x;
+        }
+        h->_prev = h;
+      }
+      _occupied[l] = 0;
+    }
+    _levels = 0;
+    _now = t;
+    while (all) {
+      Timer *n = all->_next;
+      link(all);
+      all = n;
+    }
+  }
+
+  // Only the slot matching the new time, at the highest digit which changes,
+  // needs to be redistributed.  Lower levels must be empty, since their timers
+  // would be earlier than the new time.
+  inline void TimerWheel::advance(ptime_t t)
+  {
+    if (t <= _now) {
+      if (t < _now) {
+        rebuild(t);
+      }
+      return;
+    }
+    unsigned l = highest_bit(t ^ _now) / SlotBits;
+    unsigned s = digit(t,l);
+    _now = t;
+    if (_occupied[l] & ((Word)1 << s)) {
+      Timer *h = &_slots[l][s];
+      Timer *x = h->_next;
+      h->_next = h->_prev = h;
+      _occupied[l] &= ~((Word)1 << s);
+      if (!_occupied[l]) {
+        _levels &= ~(1 << l);
+      }
+      while (x != h) {
+        Timer *n = x->_next;
+        link(x);
+        x = n;
+      }
+    }
+  }
+
+  // The timer is unlinked before its function is called, so the function may
+  // re-arm it or destroy it.  The slot is first moved to a local list, so that
+  // a timer re-armed with no delay goes back into the wheel and expires on the
+  // next call, rather than being run again by this one.  Timers on the local
+  // list may still be cancelled by the functions:  unlink() finds the slot
+  // empty, or refilled by re-armed timers, so the bitmaps stay correct.
+  inline void TimerWheel::expire(TVect &v)
+  {
+    unsigned s = digit(_now,0);
+    Timer *h = &_slots[0][s];
+    if (h->_next == h) {
+      return;
+    }
+    Timer batch;
+    batch._next = h->_next;
+    batch._prev = h->_prev;
+    batch._next->_prev = &batch;
+    batch._prev->_next = &batch;
+    h->_next = h->_prev = h;
+    _occupied[0] &= ~((Word)1 << s);
+    if (!_occupied[0]) {
+      _levels &= ~1;
+    }
+    while (batch._next != &batch) {
+      Timer *x = batch._next;
+      assert(x->_when == _now);
+      remove(x);
+      if (THandle t = (x->_func)(x->_arg)) {
+        v.push_back(t);
+      }
+    }
+    // The list head is not a real timer (see ~TimerWheel).
+    batch._next = batch._prev = 0;
+  }
+
+}
+
+#endif
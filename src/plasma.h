@@ -14,8 +14,11 @@
 
 #include <stdarg.h>
 #include <list>
+#include <vector>
+#include <string>
 
 #include "ChanSupport.h"
+#include "RingBuffer.h"
 
 #define pTMutex
 
@@ -32,25 +35,61 @@ namespace plasma {
   char *gc_strdup(const char *);
   char *gc_strdup(const std::string &s);
 
+  // Handle to an immutable, garbage-collected copy of an object.  Copying the
+  // handle does not copy the object, so a large payload may be sent through a
+  // channel, or to every sink of a Broadcaster, e.g. Channel<Shared<Packet> >,
+  // without being copied each time.  The object is destroyed when it is no
+  // longer referenced.
+  template <class Data>
+  class Shared {
+  public:
+    typedef Data element_type;
+
+    Shared() : _p(0) {};
+    Shared(const Data &x) : _p(new Holder(x)) {};
+
+    const Data &operator*() const { return _p->_data; };
+    const Data *operator->() const { return &_p->_data; };
+    const Data *get() const { return (_p) ? &_p->_data : 0; };
+    bool null() const { return !_p; };
+
+  private:
+    struct Holder : public gc_cleanup {
+      Holder(const Data &x) : _data(x) {};
+      Data _data;
+    };
+
+    Holder *_p;
+  };
+
   // Basic channel class:  Stores only a single piece of data, so 
   // a second write before a read will block.  This is generally
   // used bya single producer to go to a single consumer, but it is
   // possible to have multiple producers.
+  // If handoff is true, a write which finds a blocked reader switches directly
+  // to that reader (see pHandoff), rather than adding it to the ready queue
+  // and continuing.  This saves a context switch per item in a chain of
+  // threads connected by channels.
   template <class Data,class Base = SingleConsumerChannel >
   pTMutex class Channel : public SingleDataChannelBase, public Base {
   public:
     typedef Data value_type;
 
-    Channel() {};
+    Channel(bool handoff = false) : _handoff(handoff) {};
+    pNoMutex bool handoff() const { return _handoff; };
+    void setHandoff(bool h) { _handoff = h; };
     void write(const Data &d);
     Data read() { return read_internal(false); };
     Data get() { return read_internal(true); };
+    // Same as get(), but assigns directly to d, avoiding a temporary copy.
+    void get_into(Data &d) { d = read_internal(true); };
     void clear() { clear_ready(); };
 
   private:
-    Data read_internal(bool clear_ready);
+    const Data &read_internal(bool clear_ready);
     
     Data _data;
+    bool _handoff;   // Switch directly to a blocked reader on a write.
   };
 
   // This is similiar to Channel in that it stores a single item, but if a read
@@ -70,10 +109,11 @@ namespace plasma {
     void write(const Data &d);
     Data read() { return read_internal(false); };
     Data get() { return read_internal(true); };
+    void get_into(Data &d) { d = read_internal(true); };
     void clear() { clear_ready(); };
 
   private:
-    Data read_internal(bool clear_ready);
+    const Data &read_internal(bool clear_ready);
 
     Data       _data;
     ptime_t    _timeslice;
@@ -82,25 +122,36 @@ namespace plasma {
   // Queued channel class:  The class may store either an arbitrary number of
   // objects or a fixed number.  If a fixed number, a write will block if the
   // channel is full.  This is designed for multiple producers to feed data to
-  // a single consumer.  If size is 0, then no max size exists.
+  // a single consumer.  If size is 0, then no max size exists.  Data is kept
+  // in a ring buffer which is sized up front for a bounded channel and grows
+  // as needed for an unbounded one.
   template <typename Data,typename Base = SingleConsumerChannel,
-            typename Container = std::list<Data,traceable_allocator<Data> > >
+            typename Container = RingBuffer<Data,traceable_allocator<Data> > >
   pTMutex class QueueChan : public Base, public MultiProducerChannel {
     typedef Container Store;
   public:
     typedef Data value_type;
 
-    QueueChan(int size = 0) : _maxsize(size), _size(0) {};
+    QueueChan(int size = 0) : _maxsize(size), _size(0), _source_channel(this) { reserve_store(_store,size); };
     void write(const Data &d);
+    // Write the items [first,last).  The reader is woken once, when the batch
+    // has been written or the queue fills up.  The batch may be interleaved
+    // with other writers' data if the queue becomes full.
+    void write_n(const Data *first,const Data *last);
     bool ready() const { return !empty(); };
     bool full() const { return _maxsize && _size >= _maxsize; };
     bool empty() const { return _size == 0; };
     int size() const { return _size; };
     pNoMutex int maxsize() const { return _maxsize; };
-    void setMaxSize(int ms) { _maxsize = ms; }
+    void setMaxSize(int ms) { _maxsize = ms; reserve_store(_store,ms); }
     void clear_ready() { if (_size) { --_size; _store.pop_back(); } };
     Data read() { return read_internal(false); };
     Data get() { return read_internal(true); };
+    // Same as get(), but assigns directly to d, avoiding a temporary copy.
+    void get_into(Data &d) { wait_data(true); d = _store.back(); consumed(true); };
+    // Get up to max items, blocking until at least one is available.  Returns
+    // the number of items stored to out.
+    unsigned get_n(Data *out,unsigned max);
     void clear() { clear_data(); };
 
     void *get_source_channel() const { return _source_channel; };
@@ -109,6 +160,8 @@ namespace plasma {
     void check_size() const { assert(!_maxsize || _size <= _maxsize); }
     void clear_data() { _store.clear(); _size = 0; }
     Data read_internal(bool clear_ready);
+    void wait_data(bool clear_ready);
+    void consumed(bool clear_ready);
 
     unsigned   _maxsize;   // Max size.  If 0, no fixed size.
     unsigned   _size;      // Current size of queue.
@@ -158,20 +211,28 @@ namespace plasma {
   // If the size if 0, then the writer is fully interlocked with the reader- the writer
   // will sleep until a reader reads the value.
   template <typename Data,typename Base = SingleConsumerClockChannel,
-            typename Container = std::list<std::pair<Data,ptime_t>,traceable_allocator<std::pair<Data,ptime_t> > > >
+            typename Container = RingBuffer<std::pair<Data,ptime_t>,traceable_allocator<std::pair<Data,ptime_t> > > >
   pTMutex class ClockChan : Base, public MultiProducerChannel {
     typedef std::pair<Data,ptime_t> DP;
     typedef Container Store;
   public:
     typedef Data value_type;
 
-    ClockChan(ptime_t p = DefaultClockPeriod,ptime_t s = 0,int size = 0) : Base(p,s,size) {};
+    ClockChan(ptime_t p = DefaultClockPeriod,ptime_t s = 0,int size = 0) : Base(p,s,size) { reserve_store(_store,size); };
     void write(const Data &d);
+    // Batched versions of write and get.  See QueueChan.  get_n only returns
+    // the items which are readable at the current time.  If the channel is
+    // fully interlocked (size 0), write_n waits for each item to be read
+    // before writing the next.
+    void write_n(const Data *first,const Data *last);
     bool ready() const { return current_data() && Base::is_phi(); };
 
     void clear_ready() { if (!empty()) { Base::decr_size(); _store.pop_back(); } };
     Data read() { return read_internal(false); };
     Data get() { return read_internal(true); };
+    // Same as get(), but assigns directly to d, avoiding a temporary copy.
+    void get_into(Data &d) { wait_data(true); d = _store.back().first; consumed(true); };
+    unsigned get_n(Data *out,unsigned max);
     void clear();
 
     using Base::maxsize;
@@ -184,10 +245,13 @@ namespace plasma {
     using Base::get_source_channel;
     using Base::set_source_channel;
     using Base::multiple_consumers_allowed;
+    using Base::read_blocks;
 
   private:
     bool current_data() const;
     Data read_internal(bool clear_ready);
+    void wait_data(bool clear_ready);
+    void consumed(bool clear_ready);
     ptime_t curr_data_time() const { return _store.back().second; };
     ptime_t curr_time() const { return pTime(); };
 
@@ -241,6 +305,11 @@ namespace plasma {
   // However, the refector runs as a high priority thread so that the updates to
   // the reflected channels should occur before the receiving threads run, thus
   // avoiding race conditions.
+  //
+  // This still uses a reflector thread rather than MultiCastChan:  A write to
+  // the source only becomes visible at the next clock edge, which
+  // MultiCastChan has no notion of, and existing users read from the sinks as
+  // Channel objects.
   template <typename Data>
   struct ClkBroadcaster : Broadcaster<ClockChan<Data>, Channel<Data> > {
     typedef ClockChan<Data> Chan;
@@ -259,6 +328,85 @@ namespace plasma {
     using Base::get_sink;
   };
 
+  template <class Data> class MultiCastChan;
+
+  // A consumer's view of a MultiCastChan.  This is a read-only channel which
+  // may be used in alt blocks.  Sinks are obtained by calling
+  // MultiCastChan::get_sink() and only see data written after their creation.
+  template <class Data>
+  pTMutex class MultiCastSink : public SingleConsumerChannel {
+    friend class MultiCastChan<Data>;
+    typedef MultiCastChan<Data> Chan;
+  public:
+    typedef Data value_type;
+
+    MultiCastSink(Chan &c,unsigned long long next) : _chan(&c), _next(next) {};
+
+    bool ready() const { return _next < _chan->_written; };
+    Data read() { return read_internal(false); };
+    Data get() { return read_internal(true); };
+    void clear_ready();
+
+    bool multiple_producers_allowed() const { return true; };
+    void *get_source_channel() const { return _chan; };
+    void set_source_channel(void *) { };
+  private:
+    const Data &read_internal(bool clear_ready);
+    void consume();
+    void wake() { if (have_reader()) { if (THandle t = notify_reader()) { pWake(t); } } };
+
+    Chan               *_chan;
+    unsigned long long  _next;   // Sequence number of the next item to read.
+  };
+
+  // Multicast channel:  Each item written is stored once and is read by every
+  // sink, each of which keeps its own read position.  Unlike Broadcaster, no
+  // thread is needed to copy the data to each consumer; a write simply wakes
+  // any waiting sinks.  The channel holds the last size items.  A writer
+  // blocks if the slowest sink has not yet read all of them, unless overwrite
+  // is true, in which case a sink which falls behind skips to the oldest item
+  // still held.  With a size of 1, this gives the same behavior as a
+  // Broadcaster with the clear flag set.
+  template <class Data>
+  pTMutex class MultiCastChan : public MultiProducerChannel {
+    friend class MultiCastSink<Data>;
+  public:
+    typedef Data value_type;
+    typedef MultiCastSink<Data> Sink;
+
+    MultiCastChan(unsigned size = 1,bool overwrite = false);
+
+    void write(const Data &d);
+    bool full() const;
+
+    // Number of sinks.
+    bool empty() const { return _sinks.empty(); };
+    unsigned size() const { return _sinks.size(); };
+
+    // Add a new sink and return a reference to it.  Each consumer should use
+    // its own sink.
+    Sink &get_sink();
+
+    void *get_source_channel() const { return (void*)this; };
+    void set_source_channel(void *) { };
+  private:
+    typedef std::list<Sink,traceable_allocator<Sink> > Sinks;
+    typedef std::vector<Data,traceable_allocator<Data> > Store;
+
+    MultiCastChan(const MultiCastChan &);
+
+    const Data &item(unsigned long long seq) const { return _store[seq & _mask]; };
+    // Sequence number of the oldest item still held.
+    unsigned long long oldest() const { return (_written > _depth) ? _written - _depth : 0; };
+
+    unsigned           _depth;     // Number of items held.
+    bool               _overwrite; // Overwrite old items rather than blocking.
+    unsigned           _mask;      // Store size - 1.
+    Store              _store;
+    unsigned long long _written;   // Number of items written.
+    Sinks              _sinks;
+  };
+
   //////////////////////////////////////////////////////////////////////////////
   //
   // Implementation.
@@ -268,7 +416,7 @@ namespace plasma {
   /////////////// Channel ///////////////
 
   template <class Data,class Base>
-  Data Channel<Data,Base>::read_internal(bool clearready)
+  const Data &Channel<Data,Base>::read_internal(bool clearready)
   {
     // We'll be consuming data, so if we have a waiting
     // writer, it's valid to wake it up.
@@ -284,6 +432,7 @@ namespace plasma {
       pSleep();
       Base::clear_notify();
     }
+    pTrace(TraceRead,get_source_channel());
     if (clearready) {
       set_ready(false);
     }
@@ -297,9 +446,12 @@ namespace plasma {
   template <class Data,class Base>
   void Channel<Data,Base>::write(const Data &d) 
   { 
-    // If we have a waiting reader, wake it up.
-    if (Base::have_reader()) {
-      pWake(Base::notify_reader());
+    // If we have a waiting reader and we're about to block, wake it up.  If
+    // we're not going to block, it's woken below, once the data is stored.
+    if (Base::have_reader() && ready()) {
+      if (THandle t = Base::notify_reader()) {
+        pWake(t);
+      }
     }
     while (ready()) {
       // We already have data, so the write must block
@@ -310,16 +462,23 @@ namespace plasma {
     // Store data and set ready.
     _data = d;
     set_ready(true);
+    pTrace(TraceWrite,get_source_channel());
     // Reactivate a reader if one appeared while we were asleep.
     if (Base::have_reader()) {
-      pWake(Base::notify_reader());
+      if (THandle t = Base::notify_reader()) {
+        if (_handoff) {
+          pHandoff(t);
+        } else {
+          pWake(t);
+        }
+      }
     }    
   };
 
   /////////////// BusyChan ///////////////
 
   template <class Data,class Base>
-  Data BusyChan<Data,Base>::read_internal(bool clearready)
+  const Data &BusyChan<Data,Base>::read_internal(bool clearready)
   {
     // We'll be consuming data, so if we have a waiting
     // writer, it's valid to wake it up.
@@ -332,6 +491,7 @@ namespace plasma {
       Base::set_notify(pCurThread());
       pBusySleep(_timeslice);
     }
+    pTrace(TraceRead,get_source_channel());
     if (clearready) {
       set_ready(false);
     }
@@ -347,7 +507,9 @@ namespace plasma {
   { 
     // If we have a waiting reader, wake it up.
     if (Base::have_reader()) {
-      pBusyWake(Base::notify_reader());
+      if (THandle t = Base::notify_reader()) {
+        pBusyWake(t);
+      }
     }
     while (ready()) {
       // We already have data, so the write must block
@@ -358,16 +520,21 @@ namespace plasma {
     // Store data and set ready.
     _data = d;
     set_ready(true);
+    pTrace(TraceWrite,get_source_channel());
     // Reactivate a reader if one appeared while we were asleep.
     if (Base::have_reader()) {
-      pBusyWake(Base::notify_reader());
+      if (THandle t = Base::notify_reader()) {
+        pBusyWake(t);
+      }
     }    
   };
 
   /////////////// QueueChan ///////////////
 
+  // A read is split into waiting for data and removing it, so that get_into
+  // can copy the item straight from the store.
   template <typename Data,typename Base,typename Container>
-  Data QueueChan<Data,Base,Container>::read_internal(bool clearready)
+  void QueueChan<Data,Base,Container>::wait_data(bool clearready)
   {
     // If there's a waiting writer (queue is full) and we're
     // going to remove an item, then unblock the next writer here.
@@ -379,13 +546,26 @@ namespace plasma {
       Base::set_notify(pCurThread());
       pSleep();
     }
-    Data temp = _store.back();
+    pTrace(TraceRead,get_source_channel());
+  }
+
+  template <typename Data,typename Base,typename Container>
+  void QueueChan<Data,Base,Container>::consumed(bool clearready)
+  {
     if (clearready) {
       clear_ready();
     }
     if (have_writers() && clearready) {
       pAddReady(next_writer());
     }
+  }
+
+  template <typename Data,typename Base,typename Container>
+  Data QueueChan<Data,Base,Container>::read_internal(bool clearready)
+  {
+    wait_data(clearready);
+    Data temp = _store.back();
+    consumed(clearready);
     return temp;
   }
 
@@ -394,7 +574,9 @@ namespace plasma {
   { 
     // If we have a waiting reader, wake it up.
     if (Base::have_reader()) {
-      pWake(Base::notify_reader());
+      if (THandle t = Base::notify_reader()) {
+        pWake(t);
+      }
     }
     // Sleep if queue is full.  This is a loop so that if a waiting
     // writer is awakened and then another thread jumps in and writess
@@ -406,12 +588,69 @@ namespace plasma {
     _store.push_front(d);
     ++_size;
     check_size();
+    pTrace(TraceWrite,get_source_channel());
     // Reactivate a reader if one appeared while we were asleep.
     if (Base::have_reader()) {
-      pWake(Base::notify_reader());
+      if (THandle t = Base::notify_reader()) {
+        pWake(t);
+      }
     }
   };
 
+  template <typename Data,typename Base,typename Container>
+  void QueueChan<Data,Base,Container>::write_n(const Data *first,const Data *last) 
+  { 
+    pTrace(TraceWrite,get_source_channel(),last-first);
+    while (first != last) {
+      // Sleep if queue is full, first waking the reader so that it can make
+      // room.
+      while (full()) {
+        if (Base::have_reader()) {
+          if (THandle t = Base::notify_reader()) {
+            pWake(t);
+          }
+        }
+        set_writenotify(pCurThread());
+        pSleep();
+      }
+      // Add as much as will fit.
+      unsigned n = last - first;
+      if (_maxsize && n > _maxsize - _size) {
+        n = _maxsize - _size;
+      }
+      reserve_store(_store,_size + n);
+      for (unsigned i = 0; i != n; ++i) {
+        _store.push_front(*first++);
+      }
+      _size += n;
+      check_size();
+    }
+    if (Base::have_reader()) {
+      if (THandle t = Base::notify_reader()) {
+        pWake(t);
+      }
+    }
+  }
+
+  template <typename Data,typename Base,typename Container>
+  unsigned QueueChan<Data,Base,Container>::get_n(Data *out,unsigned max)
+  {
+    if (!max) {
+      return 0;
+    }
+    wait_data(true);
+    unsigned n = (max < _size) ? max : _size;
+    for (unsigned i = 0; i != n; ++i) {
+      out[i] = _store.back();
+      clear_ready();
+    }
+    // Unblock a writer for each item removed.
+    for (unsigned i = 0; i != n && have_writers(); ++i) {
+      pAddReady(next_writer());
+    }
+    return n;
+  }
+
   /////////////// ResChan ///////////////
 
   template <class Data>
@@ -442,7 +681,7 @@ namespace plasma {
   }
 
   template <typename Data,typename Base,typename Container>
-  Data ClockChan<Data,Base,Container>::read_internal(bool clearready)
+  void ClockChan<Data,Base,Container>::wait_data(bool clearready)
   {
     // If there's a waiting writer (queue is full) and we're
     // going to remove an item, then unblock the next writer here.
@@ -453,13 +692,26 @@ namespace plasma {
     while (!ready()) {
       Base::delayed_reader_wakeup();
     }
-    Data temp = _store.back().first;
+    pTrace(TraceRead,get_source_channel());
+  }
+
+  template <typename Data,typename Base,typename Container>
+  void ClockChan<Data,Base,Container>::consumed(bool clearready)
+  {
     if (clearready) {
       clear_ready();
     }
     if (have_writers() && clearready) {
       pAddReady(next_writer());
     }
+  }
+
+  template <typename Data,typename Base,typename Container>
+  Data ClockChan<Data,Base,Container>::read_internal(bool clearready)
+  {
+    wait_data(clearready);
+    Data temp = _store.back().first;
+    consumed(clearready);
     return temp;
   }
 
@@ -481,6 +733,7 @@ namespace plasma {
     _store.push_front(std::make_pair(d,curr_time()));
     Base::incr_size();
     Base::check_size();
+    pTrace(TraceWrite,get_source_channel());
     // Reactivate a reader if one appeared while we were asleep.
     if (Base::have_reader()) {
       Base::delayed_wakeup(current_data());
@@ -498,6 +751,58 @@ namespace plasma {
     }
   };
 
+  template <typename Data,typename Base,typename Container>
+  void ClockChan<Data,Base,Container>::write_n(const Data *first,const Data *last) 
+  { 
+    // A fully interlocked writer must wait for each item to be read, so
+    // there's nothing to batch.
+    if (Base::interlocked()) {
+      while (first != last) {
+        write(*first++);
+      }
+      return;
+    }
+    pTrace(TraceWrite,get_source_channel(),last-first);
+    while (first != last) {
+      // Sleep if queue is full, first waking the reader so that it can make
+      // room.
+      while (Base::full()) {
+        if (Base::have_reader()) {
+          Base::delayed_wakeup(current_data());
+        }
+        set_writenotify(pCurThread());
+        pSleep();
+      }
+      // Add as much as will fit, w/time of next clock cycle.
+      do {
+        _store.push_front(std::make_pair(*first++,curr_time()));
+        Base::incr_size();
+      } while (first != last && !Base::full());
+      Base::check_size();
+    }
+    if (Base::have_reader()) {
+      Base::delayed_wakeup(current_data());
+    }
+  }
+
+  template <typename Data,typename Base,typename Container>
+  unsigned ClockChan<Data,Base,Container>::get_n(Data *out,unsigned max)
+  {
+    if (!max) {
+      return 0;
+    }
+    wait_data(true);
+    unsigned n = 0;
+    do {
+      out[n++] = _store.back().first;
+      clear_ready();
+    } while (n != max && ready());
+    for (unsigned i = 0; i != n && have_writers(); ++i) {
+      pAddReady(next_writer());
+    }
+    return n;
+  }
+
   template <typename Data,typename Base,typename Container>
   void ClockChan<Data,Base,Container>::clear()
   {
@@ -531,6 +836,99 @@ namespace plasma {
     return _sinks.back();
   }
 
+  /////////////// MultiCastChan ///////////////
+
+  template <class Data>
+  const Data &MultiCastSink<Data>::read_internal(bool clearready)
+  {
+    while (!ready()) {
+      set_notify(pCurThread());
+      pSleep();
+      clear_notify();
+    }
+    pTrace(TraceRead,_chan);
+    // If we fell behind an overwriting channel, skip the lost items.
+    if (_next < _chan->oldest()) {
+      _next = _chan->oldest();
+    }
+    const Data &d = _chan->item(_next);
+    if (clearready) {
+      consume();
+    }
+    return d;
+  }
+
+  template <class Data>
+  void MultiCastSink<Data>::clear_ready()
+  {
+    if (ready()) {
+      consume();
+    }
+  }
+
+  // Advance past the current item.  This may have made room for a blocked
+  // writer.
+  template <class Data>
+  void MultiCastSink<Data>::consume()
+  {
+    ++_next;
+    if (_chan->have_writers()) {
+      pAddReady(_chan->next_writer());
+    }
+  }
+
+  template <class Data>
+  MultiCastChan<Data>::MultiCastChan(unsigned size,bool overwrite) :
+    _depth((size) ? size : 1),
+    _overwrite(overwrite),
+    _written(0)
+  {
+    unsigned n = 1;
+    while (n < _depth) {
+      n *= 2;
+    }
+    _store.resize(n);
+    _mask = n - 1;
+  }
+
+  template <class Data>
+  bool MultiCastChan<Data>::full() const
+  {
+    if (_overwrite) {
+      return false;
+    }
+    for (typename Sinks::const_iterator i = _sinks.begin(); i != _sinks.end(); ++i) {
+      if (_written - i->_next >= _depth) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  template <class Data>
+  void MultiCastChan<Data>::write(const Data &d)
+  {
+    // This is a loop b/c we're woken whenever any sink consumes an item, which
+    // doesn't mean that the slowest sink has done so.
+    while (full()) {
+      set_writenotify(pCurThread());
+      pSleep();
+    }
+    _store[_written & _mask] = d;
+    ++_written;
+    pTrace(TraceWrite,this);
+    for (typename Sinks::iterator i = _sinks.begin(); i != _sinks.end(); ++i) {
+      i->wake();
+    }
+  }
+
+  template <class Data>
+  typename MultiCastChan<Data>::Sink &MultiCastChan<Data>::get_sink()
+  {
+    _sinks.push_back(Sink(*this,_written));
+    return _sinks.back();
+  }
+
   // This is the reflector thread- it listens to the input channel and
   // broadcasts anything it gets to the output channel.
   template <typename InChan,typename OutChan>